@@ -0,0 +1,83 @@
+#include "Beeper.h"
+
+bool Beeper::open(int buffer_frames) {
+    SDL_AudioSpec want, have;
+    SDL_zero(want);
+    want.freq = sample_rate;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = buffer_frames;
+    want.callback = audio_callback;
+    want.userdata = this;
+    // Let SDL convert anything else, so the callback only deals with one format
+    device = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    if (device == 0)
+        return false;
+    device_sample_rate = have.freq;
+    SDL_PauseAudioDevice(device, 0);
+    return true;
+}
+
+void Beeper::close() {
+    if (device)
+        SDL_CloseAudioDevice(device);
+    device = 0;
+}
+
+void Beeper::push_edge(const SoundEdge& edge) {
+    // If the audio thread has stalled, dropping edges is all we can do
+    edges.push(edge);
+}
+
+void Beeper::set_emulated_time(uint64_t cycle, uint64_t cycle_rate) {
+    emulated_cycle_rate.store(cycle_rate, std::memory_order_relaxed);
+    emulated_cycle.store(cycle, std::memory_order_release);
+}
+
+void SDLCALL Beeper::audio_callback(void* userdata, Uint8* stream, int len) {
+    ((Beeper*)userdata)->fill((int16_t*)stream, len / sizeof(int16_t));
+}
+
+void Beeper::fill(int16_t* samples, int count) {
+    uint64_t end_cycle = emulated_cycle.load(std::memory_order_acquire);
+    uint64_t cycle_rate = emulated_cycle_rate.load(std::memory_order_relaxed);
+    uint64_t target_lag_cycles = cycle_rate * target_lag / 1000;
+
+    // Emulation went back in time (rewind or loaded state), or got too far
+    // ahead (turbo, or the main loop stalled): start over target_lag behind
+    if (audio_cycle > end_cycle || end_cycle - audio_cycle > cycle_rate * max_lag / 1000) {
+        audio_cycle = end_cycle > target_lag_cycles ? end_cycle - target_lag_cycles : 0;
+        audio_cycle_fraction = 0;
+        // Queued edges may be from before the jump; only the latest state counts
+        while (const SoundEdge* edge = edges.front()) {
+            sound_on = edge->on;
+            edges.pop();
+        }
+    }
+
+    uint32_t phase_step = (uint32_t)((uint64_t)tone_frequency * ((uint64_t)1 << 32) / device_sample_rate);
+    for (int i = 0; i < count; i++) {
+        while (const SoundEdge* edge = edges.front()) {
+            if (edge->cycle > audio_cycle)
+                break;
+            sound_on = edge->on;
+            edges.pop();
+        }
+
+        if (sound_on) {
+            samples[i] = wave_phase < 0x80000000 ? amplitude : -amplitude;
+            wave_phase += phase_step;
+        }
+        else {
+            samples[i] = 0;
+            wave_phase = 0;
+        }
+
+        // Never play past what's been emulated; hold there until the VM catches up
+        if (audio_cycle < end_cycle) {
+            audio_cycle_fraction += cycle_rate;
+            audio_cycle += audio_cycle_fraction / device_sample_rate;
+            audio_cycle_fraction %= device_sample_rate;
+        }
+    }
+}
@@ -0,0 +1,48 @@
+// Square wave sound output, driven by the VM's sound edges
+#ifndef BEEPER_H
+#define BEEPER_H
+
+#include <SDL.h>
+#include <atomic>
+#include "Chip8.h"
+#include "SpscQueue.h"
+
+// Plays each sound edge at its emulated cycle, so on/off timing is sample
+// accurate. Playback trails emulation by about target_lag, since the VM runs
+// in bursts and the edges of a burst must arrive before they're played.
+class Beeper {
+public:
+    // Open the default audio device, with buffer_frames samples per callback
+    bool open(int buffer_frames);
+    void close();
+    // Emulation thread only. Queue the VM's sound edges, then publish its current cycle
+    void push_edge(const SoundEdge& edge);
+    void set_emulated_time(uint64_t cycle, uint64_t cycle_rate);
+private:
+    constexpr static int sample_rate = 44100;
+    constexpr static int tone_frequency = 440;
+    constexpr static int16_t amplitude = 4000;
+    // Milliseconds of emulated time playback aims to trail by, and the most
+    // it may trail by before skipping ahead
+    constexpr static uint64_t target_lag = 40;
+    constexpr static uint64_t max_lag = 200;
+
+    SDL_AudioDeviceID device = 0;
+    int device_sample_rate = sample_rate;
+    SpscQueue<SoundEdge, 1024> edges;
+    std::atomic<uint64_t> emulated_cycle{0};
+    std::atomic<uint64_t> emulated_cycle_rate{1};
+
+    // Audio thread only
+    bool sound_on = false;
+    // Cycle being played, with the fraction in 1/device_sample_rate cycles
+    uint64_t audio_cycle = 0;
+    uint64_t audio_cycle_fraction = 0;
+    // Position within the square wave's period, as a fraction of 2^32
+    uint32_t wave_phase = 0;
+
+    static void SDLCALL audio_callback(void* userdata, Uint8* stream, int len);
+    void fill(int16_t* samples, int count);
+};
+
+#endif
@@ -1,14 +1,65 @@
 #include <iostream>
+#include <string>
 #include "Chimp8App.h"
 
+static void print_usage() {
+    std::cout << "Usage: Chimp8 <rom file> [--record <input log file>] [--turbo] [--profile <output file>]"
+        << " [--trace <output file>] [--observe <shared file>]"
+        << std::endl;
+}
+
 int main(int argc, char* args[]) {
     if (argc < 2) {
-        std::cout << "Usage: Chimp8 <rom file>" << std::endl;
+        print_usage();
+        return 0;
+    }
+    const char* record_file = NULL;
+    bool turbo = false;
+    const char* profile_file = NULL;
+    const char* trace_file = NULL;
+    const char* observe_file = NULL;
+    for (int i = 2; i < argc; i++) {
+        std::string arg = args[i];
+        if (arg == "--record" && i + 1 < argc)
+            record_file = args[++i];
+        else if (arg == "--turbo")
+            turbo = true;
+        else if (arg == "--profile" && i + 1 < argc)
+            profile_file = args[++i];
+        else if (arg == "--trace" && i + 1 < argc)
+            trace_file = args[++i];
+        else if (arg == "--observe" && i + 1 < argc)
+            observe_file = args[++i];
+        else {
+            print_usage();
+            return 0;
+        }
+    }
+
+#ifndef CHIMP8_PROFILER
+    if (profile_file) {
+        std::cout << "Built without CHIMP8_PROFILER, --profile is unavailable" << std::endl;
         return 0;
     }
+#endif
 
     Chimp8App app;
     app.load_rom_from_file(args[1]);
+    if (record_file)
+        app.start_recording(record_file);
+#ifdef CHIMP8_PROFILER
+    if (profile_file)
+        app.start_profiling(profile_file);
+#endif
+    if (trace_file && !app.start_tracing(trace_file)) {
+        std::cout << "Trace could not be created: " << trace_file << std::endl;
+        return 0;
+    }
+    if (observe_file && !app.start_observation_export(observe_file)) {
+        std::cout << "Shared memory could not be created: " << observe_file << std::endl;
+        return 0;
+    }
+    app.set_turbo(turbo);
     app.main_loop();
 
     return 0;
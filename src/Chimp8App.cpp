@@ -1,11 +1,17 @@
 #include "Chimp8App.h"
 #include "Platform.h"
 #include "Config.h"
+#include "Display.h"
+#include "Snapshot.h"
 #include <iostream>
 #include <stdexcept>
+#include <string>
+#include <cstring>
+#include <chrono>
 
 Chimp8App::Chimp8App() {
     load_config_into_vm(&vm);
+    vm.seed_random(SDL_GetPerformanceCounter());
 
     // Initialize SDL
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
@@ -21,126 +27,434 @@ Chimp8App::Chimp8App() {
         terminate(-1);
     }
 
-    renderer_sdl = SDL_CreateRenderer(window_sdl, -1, SDL_RENDERER_ACCELERATED);
+    Uint32 renderer_flags = SDL_RENDERER_ACCELERATED;
+    if (frame_pacing == PACING_VSYNC)
+        renderer_flags |= SDL_RENDERER_PRESENTVSYNC;
+    renderer_sdl = SDL_CreateRenderer(window_sdl, -1, renderer_flags);
     if (renderer_sdl == NULL) {
         std::cout << "Renderer could not be created! SDL_Error: " << SDL_GetError() << std::endl;
         terminate(-1);
     }
     SDL_RenderSetLogicalSize(renderer_sdl, window_width, window_height);
 
-    // Initialize SDL_mixer
-    if (sound_enabled) {
-        if (Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 1, sound_buffer_size) < 0) {
-            std::cout << "SDL_mixer could not initialize! SDL_mixer Error: " << Mix_GetError() << std::endl;
-            terminate(-1);
-        }
-        beep = Mix_LoadWAV((get_program_path() + "/" + sound_effect).c_str());
-        if (beep == NULL) {
-            std::cout << "Sound effect could not load! SDL_mixer Error: " << Mix_GetError() << std::endl;
-            terminate(-1);
-        }
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
+    display_texture = SDL_CreateTexture(renderer_sdl, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+        screen_w, screen_h);
+    if (display_texture == NULL) {
+        std::cout << "Display texture could not be created! SDL_Error: " << SDL_GetError() << std::endl;
+        terminate(-1);
+    }
+
+    frame_event = SDL_RegisterEvents(1);
+    if (frame_event == (Uint32)-1) {
+        std::cout << "Frame event could not be registered! SDL_Error: " << SDL_GetError() << std::endl;
+        terminate(-1);
+    }
+
+    frame_period = get_frame_period();
+    if (rewind_seconds > 0) {
+        uint64_t frames_per_second = SDL_GetPerformanceFrequency() / frame_period;
+        rewind.reset(new Rewind(rewind_seconds * frames_per_second, (size_t)rewind_buffer_size * 1024));
+    }
+
+    if (sound_enabled && !beeper.open(sound_buffer_size)) {
+        std::cout << "Audio device could not be opened! SDL_Error: " << SDL_GetError() << std::endl;
+        terminate(-1);
     }
 }
 
 void Chimp8App::load_rom_from_file(char* file_name) {
-    SDL_RWops* rom_file_rwops = SDL_RWFromFile(file_name, "r+b");
-    size_t rom_size;
-    void* rom_file = SDL_LoadFile_RW(rom_file_rwops, &rom_size, 1);
-
-    if (rom_file == NULL) {
-        std::cout << "ROM could not be loaded! SDL_Error: " << SDL_GetError() << std::endl;
+    MappedFile rom_file;
+    if (!rom_file.open(file_name)) {
+        std::cout << "ROM could not be loaded: " << file_name << std::endl;
         terminate(-1);
     }
 
-    vm.load_rom(rom_file, rom_size);
-    SDL_free(rom_file);
+    if (load_rom_profile(rom_file.data(), rom_file.size(), &vm))
+        std::cout << "Using the ROM database's settings for this ROM" << std::endl;
+    vm.load_rom(rom_file.data(), rom_file.size());
+    save_state_file = std::string(file_name) + save_state_extension;
 }
 
-void Chimp8App::draw_display() {
-    // Clear screen
-    SDL_SetRenderDrawColor(renderer_sdl, 0, 0, 0, 0xFF);
-    SDL_RenderClear(renderer_sdl);
+void Chimp8App::start_recording(const char* file_name) {
+    record_file = file_name;
+    input_log.start_recording(&vm, SDL_GetPerformanceCounter());
+}
+
+void Chimp8App::upload_display(const Frame& frame) {
+    // Frames may have been skipped, so compare with what was uploaded
+    bool upload_all = upload_pending;
+    auto changed = [&](int row) {
+        return upload_all || std::memcmp(frame.display[row], uploaded_display[row], sizeof(uploaded_display[row])) != 0;
+    };
+    upload_pending = false;
+    // Upload each run of consecutive changed rows
+    int row = 0;
+    while (row < screen_h) {
+        if (!changed(row)) {
+            row++;
+            continue;
+        }
+        int first_row = row;
+        while (row < screen_h && changed(row))
+            row++;
 
-    // Draw display
-    int x_scale = window_width / screen_w;
-    int y_scale = window_height / screen_h;
-    for (int i = 0; i < screen_size; i++) {
-        if (vm.get_display_pixel(i)) {
-            // Render white filled quad
-            SDL_Rect fill_rect = { (i % screen_w) * x_scale, (i / screen_w) * y_scale, x_scale, y_scale };
-            SDL_SetRenderDrawColor(renderer_sdl, 0xFF, 0xFF, 0xFF, 0xFF);
-            SDL_RenderFillRect(renderer_sdl, &fill_rect);
+        SDL_Rect rect = { 0, first_row, screen_w, row - first_row };
+        void* pixels;
+        int pitch;
+        if (SDL_LockTexture(display_texture, &rect, &pixels, &pitch) != 0)
+            continue;
+        for (int i = first_row; i < row; i++) {
+            uint32_t* row_pixels = (uint32_t*)((uint8_t*)pixels + (i - first_row) * pitch);
+            expand_display_row(frame.display[i], row_pixels, pixel_on_color, pixel_off_color);
+            std::memcpy(uploaded_display[i], frame.display[i], sizeof(uploaded_display[i]));
         }
+        SDL_UnlockTexture(display_texture);
     }
+}
+
+void Chimp8App::draw_display() {
+    // Clear letterboxing and draw display, scaled by the renderer
+    SDL_SetRenderDrawColor(renderer_sdl, 0, 0, 0, 0xFF);
+    SDL_RenderClear(renderer_sdl);
+    SDL_RenderCopy(renderer_sdl, display_texture, NULL, NULL);
 
     // Update renderer
     SDL_RenderPresent(renderer_sdl);
 }
 
+uint64_t Chimp8App::get_frame_period() {
+    SDL_DisplayMode display_mode;
+    int refresh_rate = default_refresh_rate;
+    if (SDL_GetWindowDisplayMode(window_sdl, &display_mode) == 0 && display_mode.refresh_rate > 0)
+        refresh_rate = display_mode.refresh_rate;
+    return SDL_GetPerformanceFrequency() / refresh_rate;
+}
+
+uint64_t Chimp8App::perf_ticks_to_ns(uint64_t ticks) {
+    uint64_t frequency = SDL_GetPerformanceFrequency();
+    return ticks / frequency * 1000000000 + ticks % frequency * 1000000000 / frequency;
+}
+
+void Chimp8App::wait_for_frame(uint64_t& next_frame, uint64_t frame_period) {
+    if (frame_pacing == PACING_OFF) {
+        main_sleep();
+        return;
+    }
+
+    uint64_t now = SDL_GetPerformanceCounter();
+    if (now < next_frame) {
+        precise_sleep(perf_ticks_to_ns(next_frame - now));
+        next_frame += frame_period;
+    }
+    else if (now - next_frame > frame_period) {
+        // Fell behind by more than a frame, don't try to catch up
+        next_frame = now + frame_period;
+    }
+    else
+        next_frame += frame_period;
+}
+
+bool Chimp8App::start_tracing(const char* file_name) {
+    if (!tracer.open(file_name, &vm))
+        return false;
+    vm.set_tracer(&tracer);
+    return true;
+}
+
+bool Chimp8App::start_observation_export(const char* file_name) {
+    return observation_export.open(file_name);
+}
+
+#ifdef CHIMP8_PROFILER
+void Chimp8App::start_profiling(const char* file_name) {
+    profile_file = file_name;
+    profiler.reset(new Profiler);
+    vm.set_profiler(profiler.get());
+}
+#endif
+
+void Chimp8App::set_turbo(bool enabled) {
+    turbo = enabled;
+    if (turbo) {
+        turbo_report_instructions = frames.front().instruction_count;
+        turbo_report_timestamp = SDL_GetPerformanceCounter();
+    }
+    else
+        SDL_SetWindowTitle(window_sdl, window_title);
+    if (emulation_thread.joinable())
+        send_command(COMMAND_TURBO, enabled);
+    else
+        emulation_turbo = enabled;
+}
+
+void Chimp8App::run_turbo_slice() {
+    uint64_t slice_end = SDL_GetPerformanceCounter()
+        + SDL_GetPerformanceFrequency() * turbo_present_interval / 1000;
+    do {
+        vm.run_for(turbo_batch_cycles);
+    } while (SDL_GetPerformanceCounter() < slice_end && !vm.was_exit_opcode_called() && !vm.is_blocked());
+}
+
+void Chimp8App::report_turbo_speed() {
+    uint64_t now = SDL_GetPerformanceCounter();
+    uint64_t elapsed = now - turbo_report_timestamp;
+    if (elapsed < SDL_GetPerformanceFrequency() * turbo_report_interval / 1000)
+        return;
+    uint64_t instructions = frames.front().instruction_count - turbo_report_instructions;
+    double instructions_per_second = (double)instructions * SDL_GetPerformanceFrequency() / elapsed;
+    std::string title = std::string(window_title) + " [turbo: "
+        + std::to_string((uint64_t)(instructions_per_second / 1000000)) + "M instructions/s]";
+    SDL_SetWindowTitle(window_sdl, title.c_str());
+    turbo_report_instructions = frames.front().instruction_count;
+    turbo_report_timestamp = now;
+}
+
 void Chimp8App::main_loop() {
-    uint64_t frame_timestamp = SDL_GetTicks64();
-    int delay_metatimer = 0;
-    int sound_metatimer = 0;
+    emulation_thread = std::thread(&Chimp8App::emulation_loop, this);
     bool running = true;
     while (running) {
-        while (SDL_PollEvent(&event_sdl) != 0) {
-            if (event_sdl.type == SDL_QUIT)
-                running = false;
-            else if (event_sdl.type == SDL_KEYDOWN) {
-                for (int i = 0; i < key_count; i++) {
-                    if (event_sdl.key.keysym.scancode == keymap[i]) {
-                        vm.on_keypress(i);
-                        break;
-                    }
-                }
+        // Sleep until there's input, or the emulation thread has something new
+        if (SDL_WaitEventTimeout(&event_sdl, blocked_wait_timeout)) {
+            running = handle_event(event_sdl);
+            while (running && SDL_PollEvent(&event_sdl) != 0)
+                running = handle_event(event_sdl);
+        }
+        if (emulation_stopped.load(std::memory_order_acquire)) {
+            emulation_thread.join();
+            if (!emulation_error.empty()) {
+                SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, window_title, emulation_error.c_str(), window_sdl);
+                terminate(-1);
             }
-            else if (event_sdl.type == SDL_KEYUP) {
-                for (int i = 0; i < key_count; i++) {
-                    if (event_sdl.key.keysym.scancode == keymap[i]) {
-                        vm.on_keyrelease(i);
-                        break;
-                    }
-                }
+            terminate(0);
+        }
+        if (frames.update())
+            redraw_pending = true;
+        if (redraw_pending) {
+            upload_display(frames.front());
+            draw_display();
+            redraw_pending = false;
+        }
+        if (turbo)
+            report_turbo_speed();
+    }
+
+    terminate(0);
+}
+
+bool Chimp8App::handle_event(const SDL_Event& event) {
+    if (event.type == SDL_QUIT)
+        return false;
+    if (event.type == frame_event)
+        frame_event_pending.store(false, std::memory_order_relaxed);
+    else if (event.type == SDL_WINDOWEVENT)
+        redraw_pending = true;
+    else if (event.type == SDL_RENDER_DEVICE_RESET) {
+        // Texture contents were lost
+        upload_pending = true;
+        redraw_pending = true;
+    }
+    else if (event.type == SDL_KEYDOWN && event.key.keysym.scancode == save_state_key)
+        send_command(COMMAND_SAVE_STATE, 0);
+    else if (event.type == SDL_KEYDOWN && event.key.keysym.scancode == load_state_key)
+        send_command(COMMAND_LOAD_STATE, 0);
+    else if (event.type == SDL_KEYDOWN && event.key.keysym.scancode == turbo_key) {
+        if (!event.key.repeat)
+            set_turbo(!turbo);
+    }
+    else if ((event.type == SDL_KEYDOWN || event.type == SDL_KEYUP)
+        && event.key.keysym.scancode == rewind_key)
+        send_command(COMMAND_REWIND, event.type == SDL_KEYDOWN);
+    else if (event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) {
+        for (int i = 0; i < key_count; i++) {
+            if (event.key.keysym.scancode == keymap[i]) {
+                send_command(event.type == SDL_KEYDOWN ? COMMAND_KEY_DOWN : COMMAND_KEY_UP, i);
+                break;
             }
         }
-        uint64_t delta_time = SDL_GetTicks64() - frame_timestamp;
-        frame_timestamp = SDL_GetTicks64();
+    }
+    return true;
+}
+
+void Chimp8App::send_command(CommandType type, int value) {
+    if (!commands.push({ type, value })) {
+        std::cout << "Emulation isn't keeping up with input, a command was dropped" << std::endl;
+        return;
+    }
+    wake_emulation();
+}
+
+void Chimp8App::wake_emulation() {
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        wake_pending = true;
+    }
+    wake_condition.notify_one();
+}
+
+void Chimp8App::wake_render() {
+    // One pending event at a time is enough
+    if (frame_event_pending.exchange(true, std::memory_order_relaxed))
+        return;
+    SDL_Event event;
+    SDL_zero(event);
+    event.type = frame_event;
+    SDL_PushEvent(&event);
+}
+
+void Chimp8App::emulation_loop() {
+    uint64_t frame_timestamp = SDL_GetPerformanceCounter();
+    uint64_t next_frame = frame_timestamp + frame_period;
+    // Generation of the display when it was last published
+    uint64_t published_generation = vm.get_display_generation();
+    publish_frame();
+    while (!quit_requested.load(std::memory_order_acquire)) {
+        while (const Command* command = commands.front()) {
+            run_command(*command);
+            commands.pop();
+        }
+        if (observation_export.is_open())
+            apply_shared_keys();
+        // Run all emulation due since the last frame as one batch
+        uint64_t now = SDL_GetPerformanceCounter();
+        uint64_t delta_time = perf_ticks_to_ns(now - frame_timestamp);
+        frame_timestamp = now;
         try {
-            vm.tick(1e6*delta_time);
+            if (rewinding)
+                rewind->step_back(&vm);
+            else {
+                if (emulation_turbo)
+                    run_turbo_slice();
+                else
+                    vm.tick(delta_time, perf_ticks_to_ns(frame_period) * max_tick_frames);
+                if (rewind)
+                    rewind->capture(&vm);
+            }
         }
-        catch (std::runtime_error err) {
-            SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, window_title, err.what(), window_sdl);
-            terminate(-1);
+        catch (std::runtime_error& err) {
+            emulation_error = err.what();
+            break;
         }
+        if (observation_export.is_open())
+            observation_export.publish(&vm);
         if (vm.was_exit_opcode_called())
-            terminate(0);
-        delay_metatimer += delta_time;
-        sound_metatimer += delta_time;
-        vm.cycle_delaytimer(delay_metatimer);
-        uint8_t sound_timer = vm.cycle_soundtimer(sound_metatimer);
-        if (sound_enabled) {
-            if (sound_timer > 0 && !Mix_Playing(0)) {
-                Mix_PlayChannel(0, beep, -1);
-            }
-            else if (sound_timer == 0 && Mix_Playing(0)) {
-                Mix_HaltChannel(0);
+            break;
+        SoundEdge sound_edges[max_sound_edges];
+        int sound_edge_count = vm.take_sound_edges(sound_edges);
+        for (int i = 0; i < sound_edge_count; i++)
+            beeper.push_edge(sound_edges[i]);
+        beeper.set_emulated_time(vm.get_cycle_count(), vm.get_cycle_rate());
+        // Turbo mode's speed report needs the instruction count
+        if (vm.get_display_generation() != published_generation || emulation_turbo) {
+            publish_frame();
+            published_generation = vm.get_display_generation();
+        }
+        // The controller's keys can't wake the thread, so keep polling them every frame
+        if (vm.is_blocked() && !rewinding && !observation_export.is_open()) {
+            // Nothing to emulate until a command arrives
+            {
+                std::unique_lock<std::mutex> lock(wake_mutex);
+                wake_condition.wait_for(lock, std::chrono::milliseconds(blocked_wait_timeout),
+                    [this] { return wake_pending; });
+                wake_pending = false;
             }
+            // Emulated time stands still while blocked, rather than being run in a burst afterwards
+            frame_timestamp = SDL_GetPerformanceCounter();
+            next_frame = frame_timestamp + frame_period;
         }
-        draw_display();
-        main_sleep();
+        else if (!emulation_turbo)
+            wait_for_frame(next_frame, frame_period);
     }
 
-    terminate(0);
+    if (!quit_requested.load(std::memory_order_acquire)) {
+        emulation_stopped.store(true, std::memory_order_release);
+        wake_render();
+    }
+}
+
+void Chimp8App::run_command(const Command& command) {
+    switch (command.type) {
+        case COMMAND_KEY_DOWN:
+            set_key(command.value, true);
+            break;
+        case COMMAND_KEY_UP:
+            set_key(command.value, false);
+            break;
+        case COMMAND_SAVE_STATE:
+            if (!save_snapshot_file(save_state_file, &vm))
+                std::cout << "State could not be saved: " << save_state_file << std::endl;
+            break;
+        case COMMAND_LOAD_STATE:
+            // Recorded input wouldn't replay from the restored state
+            if (!record_file.empty())
+                std::cout << "States can't be loaded while recording input" << std::endl;
+            else if (!load_snapshot_file(save_state_file, &vm))
+                std::cout << "State could not be loaded: " << save_state_file << std::endl;
+            break;
+        case COMMAND_REWIND:
+            // Recorded input wouldn't replay from a rewound state
+            rewinding = command.value && rewind && record_file.empty();
+            break;
+        case COMMAND_TURBO:
+            emulation_turbo = command.value;
+            break;
+    }
+}
+
+void Chimp8App::set_key(int key, bool pressed) {
+    if (pressed)
+        vm.on_keypress(key);
+    else
+        vm.on_keyrelease(key);
+    if (!record_file.empty())
+        input_log.record_event(&vm, key, pressed);
+}
+
+void Chimp8App::apply_shared_keys() {
+    uint16_t keys = observation_export.get_keys();
+    uint16_t changed = keys ^ shared_keys;
+    shared_keys = keys;
+    for (int key = 0; changed; key++, changed >>= 1) {
+        if (changed & 1)
+            set_key(key, (keys >> key) & 1);
+    }
+}
+
+void Chimp8App::publish_frame() {
+    // The back slot holds an old frame, so fill in all of it
+    Frame& frame = frames.back();
+    for (int row = 0; row < screen_h; row++)
+        std::memcpy(frame.display[row], vm.get_display_row(row), sizeof(frame.display[row]));
+    frame.instruction_count = vm.get_instruction_count();
+    frames.publish();
+    wake_render();
 }
 
 void Chimp8App::terminate(int error_code) {
+    if (emulation_thread.joinable()) {
+        quit_requested.store(true, std::memory_order_release);
+        wake_emulation();
+        emulation_thread.join();
+    }
+    // Includes the opcode that failed, if any
+    if (!tracer.close())
+        std::cout << "Trace could not be written" << std::endl;
+#ifdef CHIMP8_PROFILER
+    if (profiler && !profiler->write(profile_file))
+        std::cout << "Profile could not be written: " << profile_file << std::endl;
+#endif
+    if (!record_file.empty()) {
+        input_log.stop_recording(&vm);
+        if (!input_log.save(record_file))
+            std::cout << "Input log could not be saved: " << record_file << std::endl;
+    }
+    if (display_texture)
+        SDL_DestroyTexture(display_texture);
     if (window_sdl)
         SDL_DestroyWindow(window_sdl);
     if (renderer_sdl)
         SDL_DestroyRenderer(renderer_sdl);
-    if (beep)
-        Mix_FreeChunk(beep);
-    Mix_Quit();
+    beeper.close();
     SDL_Quit();
     std::exit(error_code);
 }
@@ -3,19 +3,65 @@
 
 #include <SDL_scancode.h> // stupid intellisense breaks without this BEFORE SDL.h!
 #include <SDL.h>
-#include <SDL_mixer.h>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include "Chip8.h"
+#include "InputLog.h"
+#include "Rewind.h"
+#include "Beeper.h"
+#include "Profiler.h"
+#include "Trace.h"
+#include "Observation.h"
+#include "SpscQueue.h"
+#include "TripleBuffer.h"
 
 class Chimp8App {
 public:
     Chimp8App();
     void load_rom_from_file(char* file_name);
+    // Log input from now on, saving it when the interpreter exits
+    void start_recording(const char* file_name);
+#ifdef CHIMP8_PROFILER
+    // Collect execution statistics, writing them to file_name on exit
+    void start_profiling(const char* file_name);
+#endif
+    // Trace every opcode executed into file_name until exit
+    bool start_tracing(const char* file_name);
+    // Publish the VM's state to file_name every frame, and take keys from it too
+    bool start_observation_export(const char* file_name);
+    void set_turbo(bool enabled);
+    // Emulate on a separate thread, while this one handles input and draws
     void main_loop();
 private:
     constexpr const static char* window_title = "Chimp8 - CHIP-8 Interpreter";
     constexpr static int window_width = 640;
     constexpr static int window_height = 320;
-    constexpr const static char* sound_effect = "res/beep.wav";
+    // Used for frame pacing if the display's refresh rate is unknown
+    constexpr static int default_refresh_rate = 60;
+    // Longest sleep while the VM is blocked, in ms, in case an event is missed
+    constexpr static int blocked_wait_timeout = 500;
+    // Save states go next to the ROM, with this appended to its name
+    constexpr const static char* save_state_extension = ".state";
+    constexpr static SDL_Scancode save_state_key = SDL_SCANCODE_F5;
+    constexpr static SDL_Scancode load_state_key = SDL_SCANCODE_F8;
+    // Steps back one frame per frame while held
+    constexpr static SDL_Scancode rewind_key = SDL_SCANCODE_BACKSPACE;
+    constexpr static SDL_Scancode turbo_key = SDL_SCANCODE_TAB;
+    // In turbo mode, how long to emulate between presents, in ms
+    constexpr static int turbo_present_interval = 50;
+    // Cycles run between checks of the wall clock in turbo mode
+    constexpr static uint64_t turbo_batch_cycles = 65536;
+    // How often turbo mode's speed is reported in the window title, in ms
+    constexpr static int turbo_report_interval = 1000;
+    // Commands waiting for the emulation thread, at most
+    constexpr static size_t command_queue_size = 256;
+    // ARGB8888
+    constexpr static uint32_t pixel_on_color = 0xFFFFFFFF;
+    constexpr static uint32_t pixel_off_color = 0xFF000000;
     // SDL keys for CHIP-8 keypad
     constexpr static SDL_Scancode keymap[key_count] = {
         SDL_SCANCODE_X, SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3,
@@ -23,14 +69,117 @@ private:
         SDL_SCANCODE_S, SDL_SCANCODE_D, SDL_SCANCODE_Z, SDL_SCANCODE_C,
         SDL_SCANCODE_4, SDL_SCANCODE_R, SDL_SCANCODE_F, SDL_SCANCODE_V
     };
-    //
+    // Requests from the render thread to the emulation thread
+    enum CommandType {
+        COMMAND_KEY_DOWN,
+        COMMAND_KEY_UP,
+        COMMAND_SAVE_STATE,
+        COMMAND_LOAD_STATE,
+        COMMAND_REWIND,
+        COMMAND_TURBO,
+    };
+    struct Command {
+        CommandType type;
+        // Keypad key, or whether rewinding or turbo mode starts or stops
+        int value;
+    };
+    // Display and statistics as of the end of an emulation batch
+    struct Frame {
+        uint64_t display[screen_h][display_row_words];
+        uint64_t instruction_count;
+    };
+
     SDL_Window* window_sdl = NULL;
     SDL_Renderer* renderer_sdl = NULL;
-    Mix_Chunk* beep = NULL;
+    // Framebuffer at native resolution, scaled to the window when rendered
+    SDL_Texture* display_texture = NULL;
+    Beeper beeper;
     SDL_Event event_sdl;
+    // Frame duration in performance counter ticks
+    uint64_t frame_period = 0;
+    // Frames of host time one tick may emulate, so a late frame is made up
+    // for but a longer stall is dropped
+    constexpr static int max_tick_frames = 2;
+
+    // Owned by the emulation thread while it runs
     Chip8 vm;
+    InputLog input_log;
+    // Empty if not recording
+    std::string record_file;
+    std::string save_state_file;
+    // NULL if rewinding is disabled
+    std::unique_ptr<Rewind> rewind;
+#ifdef CHIMP8_PROFILER
+    std::unique_ptr<Profiler> profiler;
+    std::string profile_file;
+#endif
+    Tracer tracer;
+    ObservationExport observation_export;
+    // Keys held through observation_export as last applied
+    uint16_t shared_keys = 0;
+    // Emulate as fast as possible, presenting at turbo_present_interval
+    bool emulation_turbo = false;
+    // Step back one frame per frame
+    bool rewinding = false;
+
+    // Shared between the threads
+    std::thread emulation_thread;
+    SpscQueue<Command, command_queue_size> commands;
+    TripleBuffer<Frame> frames;
+    // Set by the render thread to stop emulation
+    std::atomic<bool> quit_requested{false};
+    // Set by the emulation thread once it stops by itself, after setting emulation_error
+    std::atomic<bool> emulation_stopped{false};
+    // Empty if the ROM exited normally
+    std::string emulation_error;
+    // Whether the render thread has yet to receive the last frame_event
+    std::atomic<bool> frame_event_pending{false};
+    // Wakes the emulation thread while the VM is blocked
+    std::mutex wake_mutex;
+    std::condition_variable wake_condition;
+    bool wake_pending = false;
 
+    // Render thread only
+    bool turbo = false;
+    // Event type the emulation thread wakes the render thread with
+    Uint32 frame_event = 0;
+    // Display as uploaded to display_texture
+    uint64_t uploaded_display[screen_h][display_row_words] = {};
+    // Upload every row, e.g. after the texture's contents were lost
+    bool upload_pending = true;
+    // Present even if the display didn't change, e.g. after the window was exposed
+    bool redraw_pending = true;
+    // Instruction count and time at the last turbo speed report
+    uint64_t turbo_report_instructions = 0;
+    uint64_t turbo_report_timestamp = 0;
+
+    // Expand the rows of the display that changed since the last upload into display_texture
+    void upload_display(const Frame& frame);
     void draw_display();
+    uint64_t get_frame_period();
+    uint64_t perf_ticks_to_ns(uint64_t ticks);
+    // Wait until next_frame according to frame_pacing, and schedule the following one
+    void wait_for_frame(uint64_t& next_frame, uint64_t frame_period);
+    // Returns false once the window is closed
+    bool handle_event(const SDL_Event& event);
+    // Queue a command and wake the emulation thread to run it
+    void send_command(CommandType type, int value);
+    void wake_emulation();
+    // Have the render thread check for frames and whether emulation stopped
+    void wake_render();
+
+    void emulation_loop();
+    void run_command(const Command& command);
+    // Press or release a keypad key, recording it if recording
+    void set_key(int key, bool pressed);
+    // Apply changes to the keys held through observation_export
+    void apply_shared_keys();
+    void publish_frame();
+    // Emulate for turbo_present_interval of wall time, or until the VM stops or blocks
+    void run_turbo_slice();
+    // Show instructions per second in the window title, once per turbo_report_interval
+    void report_turbo_speed();
+    // Stop the emulation thread, if running, then exit
     void terminate(int error_code);
 };
 
@@ -0,0 +1,33 @@
+// libFuzzer target: runs each input as a ROM on one VM, reset between inputs
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+#include "Chip8.h"
+
+// Emulated cycles per input, enough for loops and a few timer ticks
+constexpr uint64_t fuzz_cycles = 20000;
+
+// Inputs are a settings byte followed by the ROM. Settings bits:
+// 0 legacy shift, 1 legacy memops, 2 COSMAC timing, 4-7 a key held throughout
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    // Constructed once; resetting is much cheaper than a new VM
+    static Chip8 vm;
+    if (size < 1)
+        return 0;
+    uint8_t settings = data[0];
+    vm.reset();
+    vm.set_legacy_shift(settings & 1);
+    vm.set_legacy_memops(settings & 2);
+    TimingMode timing_mode = settings & 4 ? TIMING_COSMAC : TIMING_FIXED;
+    if (vm.get_timing_mode() != timing_mode)
+        vm.set_timing_mode(timing_mode);
+    vm.load_rom(data + 1, size - 1);
+    vm.on_keypress(settings >> 4);
+    try {
+        vm.run_for(fuzz_cycles);
+    }
+    catch (std::runtime_error&) {
+        // Stack overflow and underflow are reported as errors, not bugs
+    }
+    return 0;
+}
@@ -0,0 +1,417 @@
+// Display-less runner: executes a ROM for a fixed budget as fast as possible and prints stats
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <memory>
+#include "Chip8.h"
+#include "Config.h"
+#include "InputLog.h"
+#include "Snapshot.h"
+#include "Rewind.h"
+#include "Profiler.h"
+#include "Trace.h"
+#include "Chip8Batch.h"
+#include "ThreadPool.h"
+#include "Platform.h"
+
+constexpr uint64_t default_frame_budget = 600;
+constexpr uint64_t frames_per_second = 60;
+// Cycles run between checks for the exit opcode
+constexpr uint64_t cycle_batch = 1024;
+
+static void print_usage() {
+    std::cout << "Usage: chimp8-headless <rom file> [options]\n"
+        << "  --cycles N        Run N VM cycles\n"
+        << "  --frames N        Run N frames (1/60 s of emulated time each, default "
+        << default_frame_budget << ")\n"
+        << "  --timing MODE     fixed or cosmac\n"
+        << "  --rate N          Cycles per second in fixed timing mode\n"
+        << "  --legacy-shift    Use CHIP-8 8XY6/8XYE behavior\n"
+        << "  --legacy-memops   Use CHIP-8 FX55/FX65 behavior\n"
+        << "  --config          Start from the interpreter's config file settings, and the\n"
+        << "                    ROM database's for this ROM\n"
+        << "  --replay FILE     Replay an input log recorded by Chimp8 --record, using its\n"
+        << "                    settings and running to its end\n"
+        << "  --load-state FILE Start from a save state instead of a fresh VM\n"
+        << "  --save-state FILE Save the final state\n"
+        << "  --rewind SECONDS  Capture rewind history every frame, and report its cost\n"
+        << "  --profile FILE    Write execution statistics as JSON, or CSV if FILE ends in .csv\n"
+        << "                    (needs a build with CHIMP8_PROFILER)\n"
+        << "  --trace FILE      Write a binary trace of every opcode executed, for chimp8-trace\n"
+        << "  --seed N          Seed for CXNN's random numbers (default 0)\n"
+        << "  --batch N         Run N instances in lockstep with fixed timing, seeded N, N+1, ...\n"
+        << "  --threads N       Threads for --batch (default: one per hardware thread)\n"
+        << "  --check-batch     Also run each --batch instance as a single VM, and compare\n"
+        << "                    their displays and how they stopped\n";
+}
+
+// FNV-1a over the framebuffer, a byte per pixel. get_row returns a packed display row
+template<typename RowGetter>
+static uint64_t display_checksum(RowGetter get_row) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (int row = 0; row < screen_h; row++) {
+        const uint64_t* words = get_row(row);
+        for (int x = 0; x < screen_w; x++) {
+            hash ^= (words[x / 64] >> (63 - x % 64)) & 1;
+            hash *= 0x100000001b3;
+        }
+    }
+    return hash;
+}
+
+static const char* batch_status_name(BatchStatus status) {
+    switch (status) {
+        case BATCH_EXITED:
+            return "exited";
+        case BATCH_FAULTED:
+            return "faulted";
+        default:
+            return "running";
+    }
+}
+
+// Run a single Chip8 the way a batch instance runs, with vm's settings.
+// It steps a cycle at a time, to stop on the same opcode a batch instance
+// does: Chip8 keeps running after 00FD
+static BatchStatus run_like_batch_instance(Chip8& vm, MappedFile& rom, uint64_t seed,
+    uint64_t cycle_count, uint64_t& checksum) {
+    std::unique_ptr<Chip8> single(new Chip8);
+    single->set_timing_mode(TIMING_FIXED);
+    single->set_legacy_shift(vm.get_legacy_shift());
+    single->set_legacy_memops(vm.get_legacy_memops());
+    single->set_cycle_rate(config_cycle_rate);
+    single->seed_random(seed);
+    single->load_rom(rom.data(), rom.size());
+    BatchStatus status = BATCH_RUNNING;
+    try {
+        for (uint64_t i = 0; i < cycle_count && !single->was_exit_opcode_called(); i++)
+            single->run_for(1);
+        if (single->was_exit_opcode_called())
+            status = BATCH_EXITED;
+    }
+    catch (std::runtime_error&) {
+        status = BATCH_FAULTED;
+    }
+    checksum = display_checksum([&](int row) { return single->get_display_row(row); });
+    return status;
+}
+
+// Run a Chip8Batch with the settings the options left in vm, and print stats.
+// With check, compare every instance with a single VM run the same way
+static int run_batch(Chip8& vm, MappedFile& rom, uint64_t instance_count,
+    unsigned thread_count, uint64_t seed, uint64_t cycle_budget, uint64_t frame_budget, bool check) {
+    Chip8Batch batch(instance_count);
+    batch.set_cycle_rate(config_cycle_rate);
+    batch.set_legacy_shift(vm.get_legacy_shift());
+    batch.set_legacy_memops(vm.get_legacy_memops());
+    batch.load_rom(rom.data(), rom.size());
+    for (uint64_t i = 0; i < instance_count; i++)
+        batch.seed_random(i, seed + i);
+    ThreadPool pool(thread_count);
+
+    // Frame by frame either way, like the single VM's frame mode
+    uint64_t rate = batch.get_cycle_rate();
+    if (cycle_budget == 0)
+        cycle_budget = frame_budget * rate / frames_per_second;
+    uint64_t frames_run = 0;
+    auto start_time = std::chrono::steady_clock::now();
+    while (batch.get_cycle_count() < cycle_budget) {
+        uint64_t frame_end = std::min((frames_run + 1) * rate / frames_per_second, cycle_budget);
+        batch.run_for(frame_end - batch.get_cycle_count(), &pool);
+        frames_run++;
+    }
+    std::chrono::duration<double> wall_time = std::chrono::steady_clock::now() - start_time;
+
+    uint64_t exited = 0;
+    uint64_t faulted = 0;
+    // Order-dependent combination of every instance's display checksum
+    uint64_t batch_checksum = 0xcbf29ce484222325;
+    for (uint64_t i = 0; i < instance_count; i++) {
+        exited += batch.get_status(i) == BATCH_EXITED;
+        faulted += batch.get_status(i) == BATCH_FAULTED;
+        batch_checksum ^= display_checksum([&](int row) { return batch.get_display_row(i, row); });
+        batch_checksum *= 0x100000001b3;
+    }
+    double emulated_seconds = (double)batch.get_cycle_count() / rate;
+    double wall_seconds = wall_time.count();
+    std::cout << "instances: " << instance_count << "\n"
+        << "threads: " << pool.get_thread_count() << "\n"
+        << "cycles: " << batch.get_cycle_count() << "\n"
+        << "wall_seconds: " << wall_seconds << "\n"
+        << "instance_cycles_per_second: "
+        << (wall_seconds > 0 ? instance_count * batch.get_cycle_count() / wall_seconds : 0) << "\n"
+        // Instances one core could run in real time
+        << "instances_per_core: "
+        << (wall_seconds > 0 ? instance_count * emulated_seconds / (wall_seconds * pool.get_thread_count()) : 0) << "\n"
+        << "exited: " << exited << "\n"
+        << "faulted: " << faulted << "\n"
+        << "display_checksum: " << std::hex
+        << display_checksum([&](int row) { return batch.get_display_row(0, row); }) << "\n"
+        << "batch_checksum: " << batch_checksum << std::dec << std::endl;
+    if (!check)
+        return 0;
+
+    // The batch engine has its own copy of the opcode semantics, this
+    // catches it drifting from Chip8's
+    uint64_t mismatches = 0;
+    for (uint64_t i = 0; i < instance_count; i++) {
+        uint64_t single_checksum;
+        BatchStatus single_status = run_like_batch_instance(vm, rom, seed + i, batch.get_cycle_count(), single_checksum);
+        uint64_t instance_checksum = display_checksum([&](int row) { return batch.get_display_row(i, row); });
+        BatchStatus instance_status = batch.get_status(i) == BATCH_WAITING_KEY ? BATCH_RUNNING : batch.get_status(i);
+        if (single_checksum == instance_checksum && single_status == instance_status)
+            continue;
+        mismatches++;
+        std::cout << "check_mismatch: seed " << seed + i << ", batch "
+            << batch_status_name(instance_status) << " " << std::hex << instance_checksum << ", single "
+            << batch_status_name(single_status) << " " << single_checksum << std::dec << "\n";
+    }
+    std::cout << "check_mismatches: " << mismatches << std::endl;
+    return mismatches > 0 ? 1 : 0;
+}
+
+int main(int argc, char* args[]) {
+    if (argc < 2) {
+        print_usage();
+        return 2;
+    }
+
+    Chip8 vm;
+    uint64_t cycle_budget = 0;
+    uint64_t frame_budget = default_frame_budget;
+    bool use_config = false;
+    bool legacy_shift = false;
+    bool legacy_memops = false;
+    uint64_t cycle_rate = 0;
+    const char* timing = NULL;
+    const char* rom_name = NULL;
+    const char* replay_file = NULL;
+    const char* load_state_file = NULL;
+    const char* save_state_file = NULL;
+    uint64_t rewind_frames = 0;
+    const char* profile_file = NULL;
+    const char* trace_file = NULL;
+    uint64_t seed = 0;
+    uint64_t batch_instances = 0;
+    unsigned thread_count = 0;
+    bool check_batch = false;
+
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = args[i];
+            bool has_value = i + 1 < argc;
+            if (arg == "--cycles" && has_value) {
+                cycle_budget = std::stoull(args[++i]);
+                frame_budget = 0;
+            }
+            else if (arg == "--frames" && has_value) {
+                frame_budget = std::stoull(args[++i]);
+                cycle_budget = 0;
+            }
+            else if (arg == "--timing" && has_value)
+                timing = args[++i];
+            else if (arg == "--rate" && has_value)
+                cycle_rate = std::stoull(args[++i]);
+            else if (arg == "--legacy-shift")
+                legacy_shift = true;
+            else if (arg == "--legacy-memops")
+                legacy_memops = true;
+            else if (arg == "--config")
+                use_config = true;
+            else if (arg == "--replay" && has_value)
+                replay_file = args[++i];
+            else if (arg == "--load-state" && has_value)
+                load_state_file = args[++i];
+            else if (arg == "--save-state" && has_value)
+                save_state_file = args[++i];
+            else if (arg == "--profile" && has_value)
+                profile_file = args[++i];
+            else if (arg == "--trace" && has_value)
+                trace_file = args[++i];
+            else if (arg == "--seed" && has_value)
+                seed = std::stoull(args[++i]);
+            else if (arg == "--batch" && has_value)
+                batch_instances = std::stoull(args[++i]);
+            else if (arg == "--threads" && has_value)
+                thread_count = std::stoul(args[++i]);
+            else if (arg == "--check-batch")
+                check_batch = true;
+            else if (arg == "--rewind" && has_value)
+                rewind_frames = std::stoull(args[++i]) * frames_per_second;
+            else if (arg[0] != '-' && !rom_name)
+                rom_name = args[i];
+            else {
+                print_usage();
+                return 2;
+            }
+        }
+    }
+    catch (std::logic_error&) {
+        print_usage();
+        return 2;
+    }
+    // Input logs are recorded from a fresh VM. Batches only run fresh VMs,
+    // and have no per-VM extras
+    bool batch_conflict = batch_instances > 0 && (replay_file || load_state_file || save_state_file
+        || rewind_frames > 0 || profile_file || trace_file || (timing && std::string(timing) != "fixed"));
+    if (!rom_name || (replay_file && load_state_file) || batch_conflict || (check_batch && batch_instances == 0)) {
+        print_usage();
+        return 2;
+    }
+
+    MappedFile rom;
+    if (!rom.open(rom_name)) {
+        std::cout << "ROM could not be loaded: " << rom_name << std::endl;
+        return 1;
+    }
+
+    // Unlike the windowed interpreter, never write the config back
+    if (use_config) {
+        parse_config(load_config(false), &vm);
+        load_rom_profile(rom.data(), rom.size(), &vm);
+    }
+    if (timing) {
+        if (std::string(timing) == "fixed")
+            vm.set_timing_mode(TIMING_FIXED);
+        else if (std::string(timing) == "cosmac")
+            vm.set_timing_mode(TIMING_COSMAC);
+        else {
+            print_usage();
+            return 2;
+        }
+    }
+    if (legacy_shift)
+        vm.set_legacy_shift(true);
+    if (legacy_memops)
+        vm.set_legacy_memops(true);
+    if (cycle_rate > 0)
+        config_cycle_rate = cycle_rate;
+    vm.set_cycle_rate(config_cycle_rate);
+
+    // Replays use the recorded seed instead
+    vm.seed_random(seed);
+    InputLog input_log;
+    if (replay_file) {
+        if (!input_log.load(replay_file)) {
+            std::cout << "Input log could not be loaded: " << replay_file << std::endl;
+            return 1;
+        }
+        input_log.apply_settings(&vm);
+    }
+
+    if (batch_instances > 0)
+        return run_batch(vm, rom, batch_instances, thread_count, seed, cycle_budget, frame_budget, check_batch);
+    vm.load_rom(rom.data(), rom.size());
+    if (load_state_file && !load_snapshot_file(load_state_file, &vm)) {
+        std::cout << "State could not be loaded: " << load_state_file << std::endl;
+        return 1;
+    }
+
+#ifdef CHIMP8_PROFILER
+    std::unique_ptr<Profiler> profiler;
+    if (profile_file) {
+        profiler.reset(new Profiler);
+        vm.set_profiler(profiler.get());
+    }
+#else
+    if (profile_file) {
+        std::cout << "Built without CHIMP8_PROFILER, --profile is unavailable" << std::endl;
+        return 2;
+    }
+#endif
+
+    Tracer tracer;
+    if (trace_file) {
+        if (!tracer.open(trace_file, &vm)) {
+            std::cout << "Trace could not be created: " << trace_file << std::endl;
+            return 1;
+        }
+        vm.set_tracer(&tracer);
+    }
+
+    // Sized like the interpreter's, from the config defaults
+    Rewind rewind(rewind_frames, (size_t)rewind_buffer_size * 1024);
+    std::chrono::duration<double> capture_time(0);
+
+    uint64_t cycles_run = 0;
+    uint64_t frames_run = 0;
+    const char* stop_reason = "budget";
+    int exit_code = 0;
+
+    auto start_time = std::chrono::steady_clock::now();
+    try {
+        if (replay_file) {
+            input_log.replay(&vm);
+            cycles_run = vm.get_cycle_count();
+            frames_run = cycles_run * frames_per_second / vm.get_cycle_rate();
+            stop_reason = "replay end";
+        }
+        else if (cycle_budget > 0) {
+            while (cycles_run < cycle_budget && !vm.was_exit_opcode_called()) {
+                uint64_t batch = std::min(cycle_budget - cycles_run, cycle_batch);
+                vm.run_for(batch);
+                cycles_run += batch;
+            }
+        }
+        else {
+            while (frames_run < frame_budget && !vm.was_exit_opcode_called()) {
+                // Frames split emulated time exactly, even if not a whole number of cycles
+                uint64_t frame_end = (frames_run + 1) * vm.get_cycle_rate() / frames_per_second;
+                vm.run_for(frame_end - cycles_run);
+                cycles_run = frame_end;
+                frames_run++;
+                if (rewind_frames > 0) {
+                    auto capture_start = std::chrono::steady_clock::now();
+                    rewind.capture(&vm);
+                    capture_time += std::chrono::steady_clock::now() - capture_start;
+                }
+            }
+        }
+        if (vm.was_exit_opcode_called())
+            stop_reason = "exit opcode";
+    }
+    catch (std::runtime_error& err) {
+        std::cout << "error: " << err.what() << std::endl;
+        stop_reason = "error";
+        exit_code = 1;
+    }
+    std::chrono::duration<double> wall_time = std::chrono::steady_clock::now() - start_time;
+
+#ifdef CHIMP8_PROFILER
+    if (profiler && !profiler->write(profile_file)) {
+        std::cout << "Profile could not be written: " << profile_file << std::endl;
+        exit_code = 1;
+    }
+#endif
+    // Includes the opcode that raised the error, if any
+    if (trace_file && !tracer.close()) {
+        std::cout << "Trace could not be written: " << trace_file << std::endl;
+        exit_code = 1;
+    }
+    if (save_state_file && !save_snapshot_file(save_state_file, &vm)) {
+        std::cout << "State could not be saved: " << save_state_file << std::endl;
+        exit_code = 1;
+    }
+
+    std::cout << "stop_reason: " << stop_reason << "\n"
+        << "cycles: " << cycles_run << "\n"
+        << "frames: " << frames_run << "\n"
+        << "wall_seconds: " << wall_time.count() << "\n"
+        << "cycles_per_second: " << (wall_time.count() > 0 ? cycles_run / wall_time.count() : 0) << "\n"
+        << "instructions: " << vm.get_instruction_count() << "\n"
+        << "instructions_per_second: "
+        << (wall_time.count() > 0 ? vm.get_instruction_count() / wall_time.count() : 0) << "\n"
+        << "display_checksum: " << std::hex
+        << display_checksum([&](int row) { return vm.get_display_row(row); }) << std::dec << std::endl;
+    if (trace_file)
+        std::cout << "trace_records: " << tracer.get_record_count() << std::endl;
+    if (rewind_frames > 0 && frames_run > 0) {
+        std::cout << "rewind_frames: " << rewind.get_frame_count() << "\n"
+            << "rewind_bytes: " << rewind.get_used_bytes() << "\n"
+            << "rewind_capture_us: " << capture_time.count() * 1e6 / frames_run << std::endl;
+    }
+
+    return exit_code;
+}
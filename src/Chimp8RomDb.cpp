@@ -0,0 +1,183 @@
+// ROM database builder: compiles a text list of per-ROM settings into the binary database
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <string>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include "RomDatabase.h"
+#include "Platform.h"
+#include "QuirkDetector.h"
+#include "Config.h"
+
+static void print_usage() {
+    std::cout << "Usage: chimp8-romdb hash <rom file>...\n"
+        << "       chimp8-romdb detect [--rate N] <rom file>...\n"
+        << "       chimp8-romdb build <profile list> [database file]\n"
+        << "  hash    Print each ROM's hash, as used in profile lists\n"
+        << "  detect  Run each ROM under every timing mode and quirk combination, and print\n"
+        << "          the profile that looks right. --rate is the fixed timing speed tried\n"
+        << "  build   Write the database, by default next to the interpreter's config file\n"
+        << "\n"
+        << "Profile lists have a ROM per line, # starts a comment:\n"
+        << "  <hash> <fixed|cosmac> [cycles per second] [legacy-shift] [legacy-memops]\n";
+}
+
+// Parse one line of a profile list. Returns false if it's malformed
+static bool parse_profile(const std::string& line, RomProfile& profile) {
+    std::istringstream words(line);
+    std::string hash, word;
+    words >> hash >> word;
+    if (hash.length() != 16 || hash.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos)
+        return false;
+    profile = {};
+    profile.hash = std::stoull(hash, NULL, 16);
+    if (word == "fixed")
+        profile.timing_mode = TIMING_FIXED;
+    else if (word == "cosmac")
+        profile.timing_mode = TIMING_COSMAC;
+    else
+        return false;
+    while (words >> word) {
+        if (word == "legacy-shift")
+            profile.flags |= ROM_LEGACY_SHIFT;
+        else if (word == "legacy-memops")
+            profile.flags |= ROM_LEGACY_MEMOPS;
+        else if (word.find_first_not_of("0123456789") == std::string::npos && word.length() <= 9)
+            profile.cycle_rate = std::stoul(word);
+        else
+            return false;
+    }
+    return true;
+}
+
+static int print_hashes(int count, char* file_names[]) {
+    int status = 0;
+    for (int i = 0; i < count; i++) {
+        MappedFile rom;
+        if (!rom.open(file_names[i])) {
+            std::cout << "ROM could not be loaded: " << file_names[i] << std::endl;
+            status = 1;
+            continue;
+        }
+        char hash[17];
+        std::snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)hash_rom(rom.data(), rom.size()));
+        std::cout << hash << "  # " << file_names[i] << "\n";
+    }
+    std::cout << std::flush;
+    return status;
+}
+
+// Profile list line for a profile, with the rest of the line left to the caller
+static std::string format_profile(const RomProfile& profile) {
+    char hash[17];
+    std::snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)profile.hash);
+    std::string line = std::string(hash) + (profile.timing_mode == TIMING_COSMAC ? " cosmac" : " fixed");
+    if (profile.cycle_rate > 0)
+        line += " " + std::to_string(profile.cycle_rate);
+    if (profile.flags & ROM_LEGACY_SHIFT)
+        line += " legacy-shift";
+    if (profile.flags & ROM_LEGACY_MEMOPS)
+        line += " legacy-memops";
+    return line;
+}
+
+static int detect_profiles(int count, char* file_names[]) {
+    uint64_t cycle_rate = 0;
+    if (count >= 2 && std::string(file_names[0]) == "--rate") {
+        try {
+            cycle_rate = std::stoull(file_names[1]);
+        }
+        catch (std::logic_error&) {
+            print_usage();
+            return 2;
+        }
+        count -= 2;
+        file_names += 2;
+    }
+    if (count == 0) {
+        print_usage();
+        return 2;
+    }
+    ThreadPool pool;
+    int status = 0;
+    for (int i = 0; i < count; i++) {
+        MappedFile rom;
+        if (!rom.open(file_names[i])) {
+            std::cout << "ROM could not be loaded: " << file_names[i] << std::endl;
+            status = 1;
+            continue;
+        }
+        auto start = std::chrono::steady_clock::now();
+        std::vector<QuirkRun> runs;
+        RomProfile profile = detect_rom_profile(rom.data(), rom.size(),
+            cycle_rate > 0 ? cycle_rate : config_cycle_rate, &pool, &runs);
+        profile.cycle_rate = cycle_rate;
+        std::chrono::duration<double> wall_time = std::chrono::steady_clock::now() - start;
+        int faulted = 0;
+        for (const QuirkRun& run : runs)
+            faulted += run.faulted;
+        std::cout << format_profile(profile) << "  # " << file_names[i] << ": " << faulted << " of "
+            << runs.size() << " runs faulted" << (faulted == (int)runs.size() ? ", no profile fits" : "")
+            << ", " << (int)(wall_time.count() * 1000) << " ms" << std::endl;
+    }
+    return status;
+}
+
+static int build_database(const char* list_name, std::string database_name) {
+    std::ifstream list(list_name);
+    if (!list) {
+        std::cout << "Profile list could not be loaded: " << list_name << std::endl;
+        return 1;
+    }
+    std::vector<RomProfile> profiles;
+    std::string line;
+    for (int line_number = 1; std::getline(list, line); line_number++) {
+        line = line.substr(0, line.find('#'));
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+        RomProfile profile;
+        if (!parse_profile(line, profile)) {
+            std::cout << list_name << ":" << line_number << ": malformed profile" << std::endl;
+            return 1;
+        }
+        profiles.push_back(profile);
+    }
+    std::sort(profiles.begin(), profiles.end(),
+        [](const RomProfile& a, const RomProfile& b) { return a.hash < b.hash; });
+    auto duplicate = std::adjacent_find(profiles.begin(), profiles.end(),
+        [](const RomProfile& a, const RomProfile& b) { return a.hash == b.hash; });
+    if (duplicate != profiles.end()) {
+        std::cout << "ROM listed more than once: " << format_profile(*duplicate).substr(0, 16) << std::endl;
+        return 1;
+    }
+
+    if (!write_rom_database(database_name, profiles)) {
+        std::cout << "Database could not be written: " << database_name << std::endl;
+        return 1;
+    }
+    std::cout << profiles.size() << " profiles written to " << database_name << std::endl;
+    return 0;
+}
+
+int main(int argc, char* args[]) {
+    std::string command = argc > 1 ? args[1] : "";
+    if (command == "hash" && argc > 2)
+        return print_hashes(argc - 2, args + 2);
+    if (command == "detect")
+        return detect_profiles(argc - 2, args + 2);
+    if (command == "build" && (argc == 3 || argc == 4)) {
+        try {
+            return build_database(args[2], argc == 4 ? args[3] : get_rom_database_path());
+        }
+        catch (std::runtime_error& err) {
+            std::cout << err.what() << std::endl;
+            return 1;
+        }
+    }
+    print_usage();
+    return 2;
+}
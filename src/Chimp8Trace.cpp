@@ -0,0 +1,103 @@
+// Trace decoder: prints a binary trace written with --trace as text or as a listing
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <map>
+#include <utility>
+#include <stdexcept>
+#include "Trace.h"
+#include "Disassembler.h"
+#include "Platform.h"
+
+static void print_usage() {
+    std::cout << "Usage: chimp8-trace <trace file> [options]\n"
+        << "  --listing    Print each opcode executed once, by address, with how often it ran\n"
+        << "  --tail N     Only print the last N records\n";
+}
+
+static void print_record(const TraceRecord& record) {
+    char text[96];
+    std::snprintf(text, sizeof(text), "%12llu  %03X  %04X  %-16s  I=%03X",
+        (unsigned long long)record.cycle, record.pc, record.opcode,
+        disassemble(record.opcode).c_str(), record.address_reg);
+    std::cout << text;
+    if (record.reg != trace_no_register) {
+        std::snprintf(text, sizeof(text), "  V%X=%02X", record.reg, record.value);
+        std::cout << text;
+    }
+    std::cout << "\n";
+}
+
+int main(int argc, char* args[]) {
+    const char* trace_name = NULL;
+    bool listing = false;
+    uint64_t tail = 0;
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = args[i];
+            if (arg == "--listing")
+                listing = true;
+            else if (arg == "--tail" && i + 1 < argc)
+                tail = std::stoull(args[++i]);
+            else if (arg[0] != '-' && !trace_name)
+                trace_name = args[i];
+            else {
+                print_usage();
+                return 2;
+            }
+        }
+    }
+    catch (std::logic_error&) {
+        print_usage();
+        return 2;
+    }
+    if (!trace_name) {
+        print_usage();
+        return 2;
+    }
+
+    MappedFile trace_file;
+    TraceHeader header;
+    if (!trace_file.open(trace_name) || trace_file.size() < sizeof(header)) {
+        std::cout << "Trace could not be loaded: " << trace_name << std::endl;
+        return 1;
+    }
+    std::memcpy(&header, trace_file.data(), sizeof(header));
+    if (header.magic != trace_magic || header.version != trace_version
+        || header.record_size != sizeof(TraceRecord)) {
+        std::cout << "Not a compatible trace: " << trace_name << std::endl;
+        return 1;
+    }
+    uint64_t record_count = (trace_file.size() - sizeof(header)) / sizeof(TraceRecord);
+    const uint8_t* records = trace_file.data() + sizeof(header);
+    uint64_t first = tail > 0 && tail < record_count ? record_count - tail : 0;
+
+    std::cout << "# " << (header.timing_mode == TIMING_FIXED ? "fixed" : "cosmac") << " timing, "
+        << header.cycle_rate << " cycles per second, " << record_count << " records\n";
+    if (listing) {
+        // Self-modifying code can run different opcodes at one address
+        std::map<std::pair<uint16_t, uint16_t>, uint64_t> executed;
+        for (uint64_t i = first; i < record_count; i++) {
+            TraceRecord record;
+            std::memcpy(&record, records + i * sizeof(TraceRecord), sizeof(record));
+            executed[{ record.pc, record.opcode }]++;
+        }
+        for (const auto& entry : executed) {
+            char text[64];
+            std::snprintf(text, sizeof(text), "%03X  %04X  %-16s  ; %llu", entry.first.first,
+                entry.first.second, disassemble(entry.first.second).c_str(),
+                (unsigned long long)entry.second);
+            std::cout << text << "\n";
+        }
+    }
+    else {
+        for (uint64_t i = first; i < record_count; i++) {
+            TraceRecord record;
+            std::memcpy(&record, records + i * sizeof(TraceRecord), sizeof(record));
+            print_record(record);
+        }
+    }
+    std::cout << std::flush;
+    return 0;
+}
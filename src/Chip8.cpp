@@ -1,75 +1,208 @@
 #include "Chip8.h"
 #include <cstdlib>
+#include <array>
+#include <cstddef>
+#include <algorithm>
+#include <cstring>
 #include <stdexcept>
+#include "Trace.h"
+#include "Display.h"
+#ifdef CHIMP8_PROFILER
+#include "Profiler.h"
+#endif
 
 constexpr uint64_t cosmac_cycle_rate = 220113;
+// Every opcode first goes through the interpreter's fetch and decode loop
+constexpr uint16_t cosmac_fetch_cycles = 40;
+// Once per frame, the display interrupt takes the CPU over for the whole
+// active display: the CDP1861 steals a DMA cycle for each byte it shows, and
+// the interrupt routine spends the rest of each scanline pointing it at the
+// right row again, since every row of the 64x32 display is 4 scanlines
+constexpr uint64_t cosmac_cycles_per_line = 14;
+constexpr uint64_t cosmac_display_lines = 128;
+// Entering and leaving the interrupt routine, which also decrements the timers
+constexpr uint64_t cosmac_interrupt_overhead_cycles = 44;
+constexpr uint64_t cosmac_interrupt_cycles =
+    cosmac_cycles_per_line * cosmac_display_lines + cosmac_interrupt_overhead_cycles;
+constexpr uint64_t default_random_seed = 0;
+
+// Opcodes fully identified by their first nibble; the others are resolved
+// by decode_00yx, decode_8XYx, decode_EXxy and decode_FXxy
+const OpcodeId Chip8::opcode_ids[] = {
+    OPCODE_NOP, OPCODE_1NNN, OPCODE_2NNN, OPCODE_3XNN,
+    OPCODE_4XNN, OPCODE_5XY0, OPCODE_6XNN, OPCODE_7XNN,
+    OPCODE_NOP, OPCODE_9XY0, OPCODE_ANNN, OPCODE_BNNN,
+    OPCODE_CXNN, OPCODE_DXYN, OPCODE_NOP, OPCODE_NOP
+};
 
-Chip8::opcode_ptr Chip8::opcode_funcs[] = {
-    &Chip8::opcode_00yx, &Chip8::opcode_1NNN, &Chip8::opcode_2NNN, &Chip8::opcode_3XNN,
-    &Chip8::opcode_4XNN, &Chip8::opcode_5XY0, &Chip8::opcode_6XNN, &Chip8::opcode_7XNN,
-    &Chip8::opcode_8XYx, &Chip8::opcode_9XY0, &Chip8::opcode_ANNN, &Chip8::opcode_BNNN,
-    &Chip8::opcode_CXNN, &Chip8::opcode_DXYN, &Chip8::opcode_EXxy, &Chip8::opcode_FXxy
+// Handlers specialized for each timing mode, indexed by OpcodeId
+template<TimingMode timing>
+const Chip8::opcode_ptr Chip8::opcode_handlers[] = {
+    &Chip8::opcode_nop,
+    &Chip8::opcode_00CN, &Chip8::opcode_00E0, &Chip8::opcode_00EE, &Chip8::opcode_00FB,
+    &Chip8::opcode_00FC, &Chip8::opcode_00FD, &Chip8::opcode_00FE, &Chip8::opcode_00FF,
+    &Chip8::opcode_1NNN<timing>, &Chip8::opcode_2NNN, &Chip8::opcode_3XNN<timing>, &Chip8::opcode_4XNN<timing>,
+    &Chip8::opcode_5XY0<timing>, &Chip8::opcode_6XNN, &Chip8::opcode_7XNN,
+    &Chip8::opcode_8XY0, &Chip8::opcode_8XY1, &Chip8::opcode_8XY2, &Chip8::opcode_8XY3,
+    &Chip8::opcode_8XY4, &Chip8::opcode_8XY5, &Chip8::opcode_8XY6, &Chip8::opcode_8XY7,
+    &Chip8::opcode_8XYE, &Chip8::opcode_9XY0<timing>, &Chip8::opcode_ANNN, &Chip8::opcode_BNNN<timing>,
+    &Chip8::opcode_CXNN, &Chip8::opcode_DXYN<timing>, &Chip8::opcode_EX9E<timing>, &Chip8::opcode_EXA1<timing>,
+    &Chip8::opcode_FX07, &Chip8::opcode_FX0A, &Chip8::opcode_FX15, &Chip8::opcode_FX18<timing>,
+    &Chip8::opcode_FX1E<timing>, &Chip8::opcode_FX29, &Chip8::opcode_FX33<timing>, &Chip8::opcode_FX55<timing>,
+    &Chip8::opcode_FX65<timing>
 };
 
+// COSMAC VIP machine cycles to execute each opcode, after fetching it, indexed
+// by OpcodeId. Handlers add any data-dependent cycles (skips taken, page
+// crossings, sprites...) from the tables below.
+// SUPER-CHIP opcodes didn't exist on the VIP; they're charged like 00E0
+constexpr uint16_t cosmac_execute_cycles[] = {
+    10,             // NOP
+    24, 24, 10, 24, // 00CN 00E0 00EE 00FB
+    24, 10, 10, 10, // 00FC 00FD 00FE 00FF
+    12, 26, 10, 10, // 1NNN 2NNN 3XNN 4XNN
+    14, 6, 10,      // 5XY0 6XNN 7XNN
+    12, 44, 44, 44, // 8XY0 8XY1 8XY2 8XY3
+    44, 44, 44, 44, // 8XY4 8XY5 8XY6 8XY7
+    44, 14, 12, 22, // 8XYE 9XY0 ANNN BNNN
+    36, 26, 14, 14, // CXNN DXYN EX9E EXA1
+    10, 2, 10, 10,  // FX07 FX0A FX15 FX18
+    16, 20, 84, 18, // FX1E FX29 FX33 FX55
+    18              // FX65
+};
+static_assert(sizeof(cosmac_execute_cycles) / sizeof(cosmac_execute_cycles[0]) == OPCODE_COUNT,
+    "COSMAC cycle table must cover every opcode");
+
+// Base cycles per opcode, fetch included
+constexpr std::array<uint16_t, OPCODE_COUNT> cosmac_opcode_cycles = [] {
+    std::array<uint16_t, OPCODE_COUNT> cycles = {};
+    for (int id = 0; id < OPCODE_COUNT; id++)
+        cycles[id] = cosmac_fetch_cycles + cosmac_execute_cycles[id];
+    return cycles;
+}();
+
+// Each sprite row is shifted into place a bit at a time, then XORed onto the
+// display along with the byte it spills into, unless it's byte-aligned
+constexpr uint16_t cosmac_sprite_row_cycles = 46;
+constexpr uint16_t cosmac_sprite_shift_cycles = 8;
+constexpr uint16_t cosmac_sprite_spill_cycles = 16;
+// Setting VF for a row that collided
+constexpr uint16_t cosmac_collision_cycles = 8;
+constexpr int max_sprite_rows = 16;
+
+// Cycles to draw a sprite, indexed by rows and by VX % 8
+constexpr std::array<std::array<uint16_t, 8>, max_sprite_rows + 1> cosmac_sprite_cycles = [] {
+    std::array<std::array<uint16_t, 8>, max_sprite_rows + 1> cycles = {};
+    for (int rows = 0; rows <= max_sprite_rows; rows++) {
+        for (int shift = 0; shift < 8; shift++) {
+            int row_cycles = cosmac_sprite_row_cycles + shift * cosmac_sprite_shift_cycles
+                + (shift ? cosmac_sprite_spill_cycles : 0);
+            cycles[rows][shift] = rows * row_cycles;
+        }
+    }
+    return cycles;
+}();
+
+
 
 Chip8::Chip8() : clock(this) {
+    tracer = NULL;
     set_timing_mode(TIMING_COSMAC);
-    cycles = 0;
-    opcode = 0;
-    for (int i = 0; i < mem_size; i++)
-        memory[i] = 0;
-    for (int i = 0; i < fontset_size; i++)
-        memory[i + font_address] = chip8_fontset[i];
-    for (int i = 0; i < reg_count; i++)
-        registers[i] = 0;
+    op = NULL;
+    std::memset(memory, 0, sizeof(memory));
+    std::memcpy(memory + font_address, chip8_fontset, sizeof(chip8_fontset));
+    std::memset(registers, 0, sizeof(registers));
     address_reg = 0;
-    for (int i = 0; i < stack_depth; i++)
-        stack[i] = 0;
+    std::memset(stack, 0, sizeof(stack));
     sp = 0;
     pc = 0x200;
     delay_timer = 0;
     sound_timer = 0;
-    for (int i = 0; i < key_count; i++)
-        keys[i] = 0;
-    for (int i = 0; i < screen_size; i++)
-        display[i] = 0;
+    std::memset(keys, 0, sizeof(keys));
+    std::memset(display, 0, sizeof(display));
+    display_generation = 0;
+    dirty_rows = all_display_rows;
     halted_keypress = false;
     keypress_store_reg = 0;
     exit_opcode_called = false;
     hi_res = false;
     legacy_shift = false;
     legacy_memops = false;
+    seed_random(default_random_seed);
+    idle_loop_cycles = 0;
+    idle_loop_opcodes = 0;
+    idle_loop_start = 0;
+    instruction_count = 0;
+    run_start_instructions = 0;
+    run_length = 0;
+    run_remaining = 0;
+    sound_edge_count = 0;
+#ifdef CHIMP8_PROFILER
+    profiler = NULL;
+#endif
+    set_reset_point();
 }
 
-void Chip8::load_rom(void* rom_file, size_t rom_size) {
-    int i = 0;
-    uint8_t* rom_by_byte = (uint8_t*)rom_file;
-    while ((i < rom_size) && (i + 0x200 < mem_size)) {
-        memory[i + 0x200] = rom_by_byte[i];
-        i++;
+void Chip8::load_rom(const void* rom_file, size_t rom_size) {
+    size_t size = std::min(rom_size, (size_t)(mem_size - 0x200));
+    std::memcpy(memory + 0x200, rom_file, size);
+    mark_memory_written(0x200, 0x200 + size);
+}
+
+void Chip8::set_reset_point() {
+    reset_state = *this;
+    reset_clock = clock.get_state();
+    reset_instruction_count = instruction_count;
+    dirty_pages = 0;
+}
+
+void Chip8::reset() {
+    // Cached opcodes stay valid for the pages that weren't written
+    for (int page = 0; dirty_pages; page++, dirty_pages >>= 1) {
+        if (!(dirty_pages & 1))
+            continue;
+        int begin = page * reset_page_size;
+        std::memcpy(memory + begin, reset_state.memory + begin, reset_page_size);
+        for (int i = begin / 2; i < (begin + reset_page_size) / 2; i++)
+            decode_cache[i].handler = NULL;
     }
+    TimingMode previous_timing_mode = timing_mode;
+    uint8_t previous_sound_timer = sound_timer;
+    // Everything after memory is small enough to copy outright
+    constexpr size_t registers_offset = offsetof(Chip8State, registers);
+    std::memcpy((uint8_t*)static_cast<Chip8State*>(this) + registers_offset,
+        (const uint8_t*)&reset_state + registers_offset, sizeof(Chip8State) - registers_offset);
+    clock.set_state(reset_clock);
+    instruction_count = reset_instruction_count;
+    idle_loop_cycles = 0;
+    idle_loop_opcodes = 0;
+    idle_loop_start = 0;
+    uint8_t restored_sound_timer = sound_timer;
+    sound_timer = previous_sound_timer;
+    set_sound_timer(restored_sound_timer, clock.get_cycle_count());
+    select_engine();
+    if (timing_mode != previous_timing_mode)
+        invalidate_decode_cache();
+    mark_display_dirty(all_display_rows);
+}
+
+// Unknown opcodes are ignored
+void Chip8::opcode_nop() {
 }
 
 // [SUPER-CHIP] Scroll display N pixels down; in low resolution mode, N/2 pixels
 void Chip8::opcode_00CN() {
-    uint8_t n = opcode & 0xF;
-    for (int i = screen_size-1; i >= 0; i--) {
-        int j = i-screen_w*n;
-        if (j < 0)
-            display[i] = false;
-        else
-            display[i] = display[j];
-    }
+    uint8_t n = op->n;
+    std::memmove(display[n], display[0], sizeof(display[0]) * (screen_h - n));
+    std::memset(display[0], 0, sizeof(display[0]) * n);
+    if (n > 0)
+        mark_display_dirty(all_display_rows);
 }
 
 // Clear display
 void Chip8::opcode_00E0() {
-    for (int i = 0; i < screen_size; i++)
-        display[i] = 0;
-    
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 24; break;
-    }
+    std::memset(display, 0, sizeof(display));
+    mark_display_dirty(all_display_rows);
 }
 
 // Return from subroutine
@@ -78,38 +211,24 @@ void Chip8::opcode_00EE() {
         throw std::runtime_error("Interpreter stack underflow");
 
     pc = stack[--sp];
-
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 10; break;
-    }
 }
 
 // [SUPER-CHIP] Scroll right by 4 pixels; in low resolution mode, 2 pixels
 void Chip8::opcode_00FB() {
     for (int row = 0; row < screen_h; row++) {
-        for (int col = screen_w-1; col >= 0; col--) {
-            int dest = col + row*screen_w;
-            int src = dest-4;
-            if (src < row*screen_w)
-                display[dest] = false;
-            else
-                display[dest] = display[src];
-        }
+        display[row][1] = (display[row][1] >> 4) | (display[row][0] << 60);
+        display[row][0] >>= 4;
     }
+    mark_display_dirty(all_display_rows);
 }
 
 // [SUPER-CHIP] Scroll left by 4 pixels; in low resolution mode, 2 pixels
 void Chip8::opcode_00FC() {
     for (int row = 0; row < screen_h; row++) {
-        for (int col = 0; col < screen_w; col++) {
-            int dest = col + row*screen_w;
-            int src = dest+4;
-            if (src >= (row+1)*screen_w)
-                display[dest] = false;
-            else
-                display[dest] = display[src];
-        }
+        display[row][0] = (display[row][0] << 4) | (display[row][1] >> 60);
+        display[row][1] <<= 4;
     }
+    mark_display_dirty(all_display_rows);
 }
 
 // [SUPER-CHIP] Exit interpreter
@@ -128,12 +247,11 @@ void Chip8::opcode_00FF() {
 }
 
 // Jump
+template<TimingMode timing>
 void Chip8::opcode_1NNN() {
-    pc = (opcode & 0xFFF) - 2;
-
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 12; break;
-    }
+    if (op->nnn <= pc && pc - op->nnn <= max_idle_loop_size)
+        detect_idle_loop<timing>(op->nnn);
+    pc = op->nnn - 2;
 }
 
 // Call subroutine
@@ -142,161 +260,116 @@ void Chip8::opcode_2NNN() {
         throw std::runtime_error("Interpreter stack overflow");
 
     stack[sp++] = pc;
-    pc = (opcode & 0xFFF) - 2;
-
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 26; break;
-    }
+    pc = op->nnn - 2;
 }
 
 // Skip next instruction if VX == NN
+template<TimingMode timing>
 void Chip8::opcode_3XNN() {
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 10; break;
-    }
-
-    int x = (opcode & 0x0F00) >> 8;
-    uint8_t nn = opcode & 0x00FF;
+    int x = op->x;
+    uint8_t nn = op->nn;
     if (registers[x] == nn) {
         pc += 2;
-        if (timing_mode == TIMING_COSMAC)
+        if constexpr (timing == TIMING_COSMAC)
             opcode_cycles += 4;
     }
 }
 
 // Skip next instruction if VX != NN
+template<TimingMode timing>
 void Chip8::opcode_4XNN() {
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 10; break;
-    }
-
-    int x = (opcode & 0x0F00) >> 8;
-    uint8_t nn = opcode & 0x00FF;
+    int x = op->x;
+    uint8_t nn = op->nn;
     if (registers[x] != nn) {
         pc += 2;
-        if (timing_mode == TIMING_COSMAC)
+        if constexpr (timing == TIMING_COSMAC)
             opcode_cycles += 4;
     }
 }
 
 // Skip next instruction if VX == VY
+template<TimingMode timing>
 void Chip8::opcode_5XY0() {
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 14; break;
-    }
-
-    int x = (opcode & 0x0F00) >> 8;
-    int y = (opcode & 0x00F0) >> 4;
+    int x = op->x;
+    int y = op->y;
     if (registers[x] == registers[y]) {
         pc += 2;
-        if (timing_mode == TIMING_COSMAC)
+        if constexpr (timing == TIMING_COSMAC)
             opcode_cycles += 4;
     }
 }
 
 // Set VX to NN
 void Chip8::opcode_6XNN() {
-    int x = (opcode & 0x0F00) >> 8;
-    uint8_t nn = opcode & 0x00FF;
+    int x = op->x;
+    uint8_t nn = op->nn;
     registers[x] = nn;
-
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 6; break;
-    }
 }
 
 // Add NN to VX (Carry flag is not changed)
 void Chip8::opcode_7XNN() {
-    int x = (opcode & 0x0F00) >> 8;
-    uint8_t nn = opcode & 0x00FF;
+    int x = op->x;
+    uint8_t nn = op->nn;
     registers[x] += nn;
-
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 10; break;
-    }
 }
 
 // Set VX to the value of VY
 void Chip8::opcode_8XY0() {
-    int x = (opcode & 0x0F00) >> 8;
-    int y = (opcode & 0x00F0) >> 4;
+    int x = op->x;
+    int y = op->y;
     registers[x] = registers[y];
-
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 12; break;
-    }
 }
 
 // Set VX to (VX | VY)
 void Chip8::opcode_8XY1() {
-    int x = (opcode & 0x0F00) >> 8;
-    int y = (opcode & 0x00F0) >> 4;
+    int x = op->x;
+    int y = op->y;
     registers[x] |= registers[y];
-
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 44; break;
-    }
 }
 
 // Set VX to (VX & VY)
 void Chip8::opcode_8XY2() {
-    int x = (opcode & 0x0F00) >> 8;
-    int y = (opcode & 0x00F0) >> 4;
+    int x = op->x;
+    int y = op->y;
     registers[x] &= registers[y];
-
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 44; break;
-    }
 }
 
 // Set VX to (VX xor VY)
 void Chip8::opcode_8XY3() {
-    int x = (opcode & 0x0F00) >> 8;
-    int y = (opcode & 0x00F0) >> 4;
+    int x = op->x;
+    int y = op->y;
     registers[x] ^= registers[y];
-
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 44; break;
-    }
 }
 
 // Add VY to VX. VF is set to 1 when there's a carry, and to 0 when there is not.
 void Chip8::opcode_8XY4() {
-    int x = (opcode & 0x0F00) >> 8;
-    int y = (opcode & 0x00F0) >> 4;
+    int x = op->x;
+    int y = op->y;
     if ((uint16_t)registers[x] + (uint16_t)registers[y] > 255)
         registers[0xF] = 1;
     else
         registers[0xF] = 0;
     registers[x] += registers[y];
-
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 44; break;
-    }
 }
 
 // VY is subtracted from VX. VF is set to 0 when there's a borrow, and 1 when there is not.
 void Chip8::opcode_8XY5() {
-    int x = (opcode & 0x0F00) >> 8;
-    int y = (opcode & 0x00F0) >> 4;
+    int x = op->x;
+    int y = op->y;
     // There's a borrow when VY > VX
     if (registers[y] > registers[x])
         registers[0xF] = 0;
     else
         registers[0xF] = 1;
     registers[x] -= registers[y];
-
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 44; break;
-    }
 }
 
 // Store the least significant bit of VX in VF, shift VX to the right by 1
 // Legacy: Store the least significant bit of VY in VF, shift VY to the right by 1, store result in VX
 void Chip8::opcode_8XY6() {
-    int x = (opcode & 0x0F00) >> 8;
+    int x = op->x;
     if (legacy_shift) {
-        int y = (opcode & 0x00F0) >> 4;
+        int y = op->y;
         registers[0xF] = registers[y] & 0x1;
         registers[y] >>= 1;
         registers[x] = registers[y];
@@ -305,34 +378,26 @@ void Chip8::opcode_8XY6() {
         registers[0xF] = registers[x] & 0x1;
         registers[x] >>= 1;
     }
-
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 44; break;
-    }
 }
 
 // Set VX to VY minus VX. VF is set to 0 when there's a borrow, and 1 when there is not.
 void Chip8::opcode_8XY7() {
-    int x = (opcode & 0x0F00) >> 8;
-    int y = (opcode & 0x00F0) >> 4;
+    int x = op->x;
+    int y = op->y;
     // There's a borrow when VX > VY
     if (registers[x] > registers[y])
         registers[0xF] = 0;
     else
         registers[0xF] = 1;
     registers[x] = registers[y] - registers[x];
-
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 44; break;
-    }
 }
 
 // Store the most significant bit of VX in VF, shift VX to the left by 1
 // Legacy: Store the most significant bit of VY in VF, shift VY to the left by 1, store result in VX
 void Chip8::opcode_8XYE() {
-    int x = (opcode & 0x0F00) >> 8;
+    int x = op->x;
     if (legacy_shift) {
-        int y = (opcode & 0x00F0) >> 4;
+        int y = op->y;
         registers[0xF] = (registers[y] & 0x80) >> 7;
         registers[y] <<= 1;
         registers[x] = registers[y];
@@ -341,62 +406,45 @@ void Chip8::opcode_8XYE() {
         registers[0xF] = (registers[x] & 0x80) >> 7;
         registers[x] <<= 1;
     }
-
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 44; break;
-    }
 }
 
 // Skip next instruction if VX != VY
+template<TimingMode timing>
 void Chip8::opcode_9XY0() {
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 14; break;
-    }
-
-    int x = (opcode & 0x0F00) >> 8;
-    int y = (opcode & 0x00F0) >> 4;
+    int x = op->x;
+    int y = op->y;
     if (registers[x] != registers[y]) {
         pc += 2;
-        if (timing_mode == TIMING_COSMAC)
+        if constexpr (timing == TIMING_COSMAC)
             opcode_cycles += 4;
     }
 }
 
 // Set I to the address NNN
 void Chip8::opcode_ANNN() {
-    uint16_t nnn = opcode & 0x0FFF;
+    uint16_t nnn = op->nnn;
     address_reg = nnn;
-
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 12; break;
-    }
 }
 
 // Jump to NNN + V0
+template<TimingMode timing>
 void Chip8::opcode_BNNN() {
-    pc = (opcode & 0xFFF) + registers[0] - 2;
-
-    switch (timing_mode) {
-        case TIMING_COSMAC:
-            opcode_cycles = 22;
-            if ((opcode & 0xFF) + registers[0] >= 0x100) {
-                // Page boundary crossed
-                opcode_cycles += 2;
-            }
-            break;
+    pc = op->nnn + registers[0] - 2;
+
+    if constexpr (timing == TIMING_COSMAC) {
+        if (op->nn + registers[0] >= 0x100) {
+            // Page boundary crossed
+            opcode_cycles += 2;
+        }
     }
 }
 
 // Set VX to the result of a bitwise and operation on a random number (0 to 255) and NN
 void Chip8::opcode_CXNN() {
-    int x = (opcode & 0x0F00) >> 8;
-    uint8_t nn = opcode & 0xFF;
-    uint8_t random_number = rand() % 256;
+    int x = op->x;
+    uint8_t nn = op->nn;
+    uint8_t random_number = next_random() >> 56;
     registers[x] = random_number & nn;
-
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 36; break;
-    }
 }
 
 // Draw a sprite at (VX, VY), with width of 8 and height of N.
@@ -407,330 +455,586 @@ void Chip8::opcode_CXNN() {
 // [SUPER-CHIP] If N=0 and extended mode, draw 16x16 sprite.
 // In extended mode, sets VF to the number of rows that either collide with
 // another sprite or are clipped by the bottom of the screen.
+template<TimingMode timing>
 void Chip8::opcode_DXYN() {
-    int x = (opcode & 0x0F00) >> 8;
-    int y = (opcode & 0x00F0) >> 4;
+    int x = op->x;
+    int y = op->y;
     uint8_t vx = (registers[x]) % screen_w;
     uint8_t vy = (registers[y]) % screen_h;
 
-    uint8_t n = opcode & 0xF;
-    int columns = 8;
+    uint8_t n = op->n;
     uint16_t I = address_reg;
-    uint8_t row;
-    int collision_count = 0;
+    bool wide = false;
     if (n == 0 && hi_res) {
         n = 16;
-        columns = 16;
+        wide = true;
     }
 
     registers[0xF] = 0;
+    int collided_rows = 0;
     for (int i = 0; i < n; i++) {
-        // Draw a row of pixels
-        int mask;
-        for (int j = 0; j < columns; j++) {
-            if (j % 8 == 0) {
-                row = memory[I++];
-                mask = 0x80;
-            }
-            bool pixel = (row & mask) ? 1 : 0;
-            draw_display_pixel(vx + j, vy + i, pixel, &collision_count);
-            mask >>= 1;
+        if (hi_res) {
+            uint16_t bits = memory[I++ % mem_size];
+            if (wide)
+                bits = (bits << 8) | memory[I++ % mem_size];
+            bool collided = draw_sprite_row((vy + i) % screen_h, bits, wide ? 16 : 8, vx);
+            if (collided || vy + i >= screen_h)
+                registers[0xF]++;
+            collided_rows += collided;
+        }
+        else {
+            // Each pixel is 2x2 in lo-res
+            uint16_t bits = lores_doubled_bits[memory[I++ % mem_size]];
+            int screen_x = (vx * 2) % screen_w;
+            int screen_y = ((vy + i) * 2) % screen_h;
+            bool collided = draw_sprite_row(screen_y, bits, 16, screen_x);
+            collided |= draw_sprite_row(screen_y + 1, bits, 16, screen_x);
+            if (collided)
+                registers[0xF] = 1;
+            collided_rows += collided;
         }
     }
-
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 3072 + n*(94 + collision_count*8); break; // Oversimplified
+#ifdef CHIMP8_PROFILER
+    if (profiler) {
+        profiler->sprites_drawn++;
+        profiler->sprite_rows_drawn += n;
+        profiler->collided_rows += collided_rows;
+        profiler->collided_sprites += collided_rows != 0;
+    }
+#endif
+
+    if constexpr (timing == TIMING_COSMAC) {
+        // The VIP waits for the display interrupt before drawing, so at most
+        // one sprite is drawn per frame
+        uint64_t elapsed = run_length - run_remaining;
+        uint64_t cycles_to_timer = clock.get_cycles_to_timer();
+        uint64_t cycles_to_interrupt = cycles_to_timer > elapsed ? cycles_to_timer - elapsed : 0;
+        opcode_cycles += cycles_to_interrupt + cosmac_sprite_cycles[n][vx % 8]
+            + collided_rows * cosmac_collision_cycles;
     }
 }
 
-// Skip next instruction if the key stored in VX is pressed
+// Skip next instruction if the key stored in VX is pressed.
+// Only the low 4 bits of VX select the key, as on the COSMAC VIP
+template<TimingMode timing>
 void Chip8::opcode_EX9E() {
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 14; break;
-    }
-
-    int x = (opcode & 0x0F00) >> 8;
+    int x = op->x;
     uint8_t vx = registers[x];
-    if (keys[vx]) {
+    if (keys[vx % key_count]) {
         pc += 2;
-        if (timing_mode == TIMING_COSMAC)
+        if constexpr (timing == TIMING_COSMAC)
             opcode_cycles += 4;
     }
 }
 
-// Skip next instruction if the key stored in VX is not pressed
+// Skip next instruction if the key stored in VX is not pressed.
+// Only the low 4 bits of VX select the key
+template<TimingMode timing>
 void Chip8::opcode_EXA1() {
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 14; break;
-    }
-
-    int x = (opcode & 0x0F00) >> 8;
+    int x = op->x;
     uint8_t vx = registers[x];
-    if (!keys[vx]) {
+    if (!keys[vx % key_count]) {
         pc += 2;
-        if (timing_mode == TIMING_COSMAC)
+        if constexpr (timing == TIMING_COSMAC)
             opcode_cycles += 4;
     }
 }
 
 // Set VX to the value of the delay timer
 void Chip8::opcode_FX07() {
-    int x = (opcode & 0x0F00) >> 8;
+    int x = op->x;
     registers[x] = delay_timer;
-
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 10; break;
-    }
 }
 
 // A key press is awaited, and then stored in VX (Blocking Operation)
 void Chip8::opcode_FX0A() {
-    keypress_store_reg = (opcode & 0x0F00) >> 8;
+    keypress_store_reg = op->x;
     halted_keypress = true;
-
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 2; break; // Oversimplified
-    }
 }
 
 // Set the delay timer to VX
 void Chip8::opcode_FX15() {
-    int x = (opcode & 0x0F00) >> 8;
+    int x = op->x;
     delay_timer = registers[x];
-
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 10; break;
-    }
 }
 
 // Set the sound timer to VX
+template<TimingMode timing>
 void Chip8::opcode_FX18() {
-    int x = (opcode & 0x0F00) >> 8;
-    sound_timer = registers[x];
-
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 10; break;
-    }
+    int x = op->x;
+    set_sound_timer(registers[x], current_cycle<timing>());
 }
 
 // Add VX to I
+template<TimingMode timing>
 void Chip8::opcode_FX1E() {
-    int x = (opcode & 0x0F00) >> 8;
+    int x = op->x;
     uint16_t prev_I = address_reg;
     address_reg += registers[x];
 
-    switch (timing_mode) {
-        case TIMING_COSMAC:
-            opcode_cycles = 16;
-            if ((prev_I & 0xFF) + registers[x] >= 0x100) {
-                // Page boundary crossed
-                opcode_cycles += 6;
-            }
-            break;
+    if constexpr (timing == TIMING_COSMAC) {
+        if ((prev_I & 0xFF) + registers[x] >= 0x100) {
+            // Page boundary crossed
+            opcode_cycles += 6;
+        }
     }
 }
 
 // Set I to the location of the sprite for the character in VX
 void Chip8::opcode_FX29() {
-    int x = (opcode & 0x0F00) >> 8;
+    int x = op->x;
     uint8_t vx = registers[x];
     address_reg = font_address + vx*5;
-
-    switch (timing_mode) {
-        case TIMING_COSMAC: opcode_cycles = 20; break;
-    }
 }
 
 // Store the binary-coded decimal representation of VX, with the most significant of
 // three digits at the address in I, the middle digit at I plus 1, and the least significant digit at I plus 2
+template<TimingMode timing>
 void Chip8::opcode_FX33() {
-    int x = (opcode & 0x0F00) >> 8;
+    int x = op->x;
     uint8_t vx = registers[x];
     uint16_t I = address_reg;
-    memory[I] = vx / 100;
-    memory[I + 1] = (vx / 10) % 10;
-    memory[I + 2] = vx % 10;
+    write_memory(I, vx / 100);
+    write_memory(I + 1, (vx / 10) % 10);
+    write_memory(I + 2, vx % 10);
 
-    switch (timing_mode) {
-        case TIMING_COSMAC:
-            opcode_cycles = 84 + (memory[I] + memory[I + 1] + memory[I + 2])*16;
-            break;
-    }
+    if constexpr (timing == TIMING_COSMAC)
+        opcode_cycles += (memory[I % mem_size] + memory[(I + 1) % mem_size] + memory[(I + 2) % mem_size])*16;
 }
 
 // Store from V0 to VX (including VX) in memory, starting at address I and increasing by 1 for each value written.
+template<TimingMode timing>
 void Chip8::opcode_FX55() {
-    int x = (opcode & 0x0F00) >> 8;
+    int x = op->x;
     for (int i = 0; i <= x; i++) {
         uint16_t address = legacy_memops ? address_reg++ : address_reg+i;
-        memory[address] = registers[i];
+        write_memory(address, registers[i]);
     }
 
-    switch (timing_mode) {
-        case TIMING_COSMAC:
-            opcode_cycles = 18 + (x+1)*14;
-            break;
-    }
+    if constexpr (timing == TIMING_COSMAC)
+        opcode_cycles += (x+1)*14;
 }
 
 // Fill from V0 to VX (including VX) with values from memory, starting at address I and increasing by 1 for each value read.
+template<TimingMode timing>
 void Chip8::opcode_FX65() {
-    int x = (opcode & 0x0F00) >> 8;
+    int x = op->x;
     for (int i = 0; i <= x; i++) {
         uint16_t address = legacy_memops ? address_reg++ : address_reg+i;
-        registers[i] = memory[address];
+        registers[i] = memory[address % mem_size];
     }
 
-    switch (timing_mode) {
-        case TIMING_COSMAC:
-            opcode_cycles = 18 + (x+1)*14;
-            break;
-    }
+    if constexpr (timing == TIMING_COSMAC)
+        opcode_cycles += (x+1)*14;
 }
 
 
-void Chip8::opcode_00yx() {
-    if (opcode & 0x00F0 == 0x00C0) {
-        opcode_00CN();
-        return;
-    }
+OpcodeId Chip8::decode_00yx(uint16_t opcode) {
+    if ((opcode & 0xFFF0) == 0x00C0)
+        return OPCODE_00CN;
     switch (opcode) {
-        case 0x00E0:
-            opcode_00E0();
-            break;
-        case 0x00EE:
-            opcode_00EE();
-            break;
-        case 0x00FB:
-            opcode_00FB();
-            break;
-        case 0x00FC:
-            opcode_00FC();
-            break;
-        case 0x00FD:
-            opcode_00FD();
-            break;
-        case 0x00FE:
-            opcode_00FE();
-            break;
-        case 0x00FF:
-            opcode_00FF();
-            break;
-    }
-}
-
-void Chip8::opcode_8XYx() {
+        case 0x00E0: return OPCODE_00E0;
+        case 0x00EE: return OPCODE_00EE;
+        case 0x00FB: return OPCODE_00FB;
+        case 0x00FC: return OPCODE_00FC;
+        case 0x00FD: return OPCODE_00FD;
+        case 0x00FE: return OPCODE_00FE;
+        case 0x00FF: return OPCODE_00FF;
+    }
+    return OPCODE_NOP;
+}
+
+OpcodeId Chip8::decode_8XYx(uint16_t opcode) {
     switch (opcode & 0xF) {
-        case 0x0:
-            opcode_8XY0();
-            break;
-        case 0x1:
-            opcode_8XY1();
-            break;
-        case 0x2:
-            opcode_8XY2();
-            break;
-        case 0x3:
-            opcode_8XY3();
-            break;
-        case 0x4:
-            opcode_8XY4();
-            break;
-        case 0x5:
-            opcode_8XY5();
-            break;
-        case 0x6:
-            opcode_8XY6();
-            break;
-        case 0x7:
-            opcode_8XY7();
-            break;
-        case 0xE:
-            opcode_8XYE();
-            break;
-    }
-}
-
-void Chip8::opcode_EXxy() {
+        case 0x0: return OPCODE_8XY0;
+        case 0x1: return OPCODE_8XY1;
+        case 0x2: return OPCODE_8XY2;
+        case 0x3: return OPCODE_8XY3;
+        case 0x4: return OPCODE_8XY4;
+        case 0x5: return OPCODE_8XY5;
+        case 0x6: return OPCODE_8XY6;
+        case 0x7: return OPCODE_8XY7;
+        case 0xE: return OPCODE_8XYE;
+    }
+    return OPCODE_NOP;
+}
+
+OpcodeId Chip8::decode_EXxy(uint16_t opcode) {
     switch (opcode & 0xF) {
-        case 0xE:
-            opcode_EX9E();
-            break;
-        case 0x1:
-            opcode_EXA1();
-            break;
+        case 0xE: return OPCODE_EX9E;
+        case 0x1: return OPCODE_EXA1;
     }
+    return OPCODE_NOP;
 }
 
-void Chip8::opcode_FXxy() {
+OpcodeId Chip8::decode_FXxy(uint16_t opcode) {
     switch (opcode & 0xFF) {
-        case 0x07:
-            opcode_FX07();
-            break;
-        case 0x0A:
-            opcode_FX0A();
-            break;
-        case 0x15:
-            opcode_FX15();
-            break;
-        case 0x18:
-            opcode_FX18();
-            break;
-        case 0x1E:
-            opcode_FX1E();
-            break;
-        case 0x29:
-            opcode_FX29();
-            break;
-        case 0x33:
-            opcode_FX33();
-            break;
-        case 0x55:
-            opcode_FX55();
-            break;
-        case 0x65:
-            opcode_FX65();
-            break;
+        case 0x07: return OPCODE_FX07;
+        case 0x0A: return OPCODE_FX0A;
+        case 0x15: return OPCODE_FX15;
+        case 0x18: return OPCODE_FX18;
+        case 0x1E: return OPCODE_FX1E;
+        case 0x29: return OPCODE_FX29;
+        case 0x33: return OPCODE_FX33;
+        case 0x55: return OPCODE_FX55;
+        case 0x65: return OPCODE_FX65;
     }
+    return OPCODE_NOP;
 }
 
-void Chip8::cycle_vm() {
-    if (halted_keypress)
+OpcodeId Chip8::decode_opcode_id(uint16_t opcode) {
+    switch ((opcode & 0xF000) >> 12) {
+        case 0x0: return decode_00yx(opcode);
+        case 0x8: return decode_8XYx(opcode);
+        case 0xE: return decode_EXxy(opcode);
+        case 0xF: return decode_FXxy(opcode);
+    }
+    return opcode_ids[(opcode & 0xF000) >> 12];
+}
+
+template<TimingMode timing>
+Chip8::DecodedOpcode Chip8::decode_opcode(uint16_t opcode) {
+    OpcodeId id = decode_opcode_id(opcode);
+    DecodedOpcode decoded;
+    decoded.handler = opcode_handlers<timing>[id];
+    decoded.cycles = cosmac_opcode_cycles[id];
+    decoded.nnn = opcode & 0x0FFF;
+    decoded.x = (opcode & 0x0F00) >> 8;
+    decoded.y = (opcode & 0x00F0) >> 4;
+    decoded.n = opcode & 0x000F;
+    decoded.nn = opcode & 0x00FF;
+#ifdef CHIMP8_PROFILER
+    decoded.id = id;
+#endif
+    return decoded;
+}
+
+void Chip8::invalidate_decode_cache() {
+    for (int i = 0; i < decode_cache_size; i++)
+        decode_cache[i].handler = NULL;
+}
+
+void Chip8::write_memory(uint16_t address, uint8_t value) {
+    // I can point past the end of memory, addresses wrap around like the PC's
+    address %= mem_size;
+    memory[address] = value;
+    // Both bytes of an opcode share a cache entry, even addresses only
+    decode_cache[address >> 1].handler = NULL;
+    dirty_pages |= (uint64_t)1 << (address / reset_page_size);
+}
+
+void Chip8::mark_memory_written(int begin, int end) {
+    if (begin >= end)
         return;
-    
-    if (cycles > 0) {
-        cycles--;
+    for (int i = begin / 2; i <= (end - 1) / 2; i++)
+        decode_cache[i].handler = NULL;
+    for (int page = begin / reset_page_size; page <= (end - 1) / reset_page_size; page++)
+        dirty_pages |= (uint64_t)1 << page;
+}
+
+// Whether the opcode is a skip that depends only on registers and keys, and
+// currently isn't taken. An idle loop changes neither, so it won't be taken
+// until the loop is left
+bool Chip8::is_waiting_skip(uint16_t opcode) {
+    uint8_t vx = registers[(opcode & 0x0F00) >> 8];
+    uint8_t vy = registers[(opcode & 0x00F0) >> 4];
+    uint8_t nn = opcode & 0x00FF;
+    switch (decode_opcode_id(opcode)) {
+        case OPCODE_3XNN:
+            return vx != nn;
+        case OPCODE_4XNN:
+            return vx == nn;
+        case OPCODE_5XY0:
+            return vx != vy;
+        case OPCODE_9XY0:
+            return vx == vy;
+        case OPCODE_EX9E:
+            return !keys[vx % key_count];
+        case OPCODE_EXA1:
+            return keys[vx % key_count];
+        default:
+            return false;
+    }
+}
+
+// Recognize loops that wait for the delay timer or a key without changing
+// anything else, e.g. 1NNN jumping to itself, or FX07 / 3X00 / 1NNN. Every
+// iteration leaves the VM in the same state until the timers or keys change,
+// which only happens between engine runs, so the engine can skip whole
+// iterations at once. Called by the jump closing the loop
+template<TimingMode timing>
+void Chip8::detect_idle_loop(uint16_t loop_start) {
+    if ((pc - loop_start) % 2 != 0)
         return;
+    int body_size = (pc - loop_start) / 2;
+    uint16_t opcodes[max_idle_loop_size / 2];
+    OpcodeId body[max_idle_loop_size / 2];
+    for (int i = 0; i < body_size; i++) {
+        uint16_t address = loop_start + i * 2;
+        opcodes[i] = (memory[address % mem_size] << 8) | memory[(address + 1) % mem_size];
+        body[i] = decode_opcode_id(opcodes[i]);
     }
+    // The loop may have been entered partway, or the keys may have changed
+    // since its opcodes ran, so check them against the current state.
+    // FX07 keeps loading the same value while the delay timer doesn't change
+    bool idle = body_size == 0
+        || (body_size == 1 && is_waiting_skip(opcodes[0]))
+        || (body_size == 2 && body[0] == OPCODE_FX07
+            && registers[(opcodes[0] & 0x0F00) >> 8] == delay_timer && is_waiting_skip(opcodes[1]));
+    if (!idle)
+        return;
 
-    // Opcode is 16 bits, big-endian
-    opcode = (memory[pc] << 8) | memory[pc + 1];
-    (this->*opcode_funcs[(opcode & 0xF000) >> 12])();
+    idle_loop_start = loop_start;
+    idle_loop_opcodes = body_size + 1;
+    if constexpr (timing == TIMING_FIXED)
+        idle_loop_cycles = idle_loop_opcodes;
+    else {
+        // Skips aren't taken inside the loop, so only base cycles count
+        idle_loop_cycles = cosmac_opcode_cycles[OPCODE_1NNN];
+        for (int i = 0; i < body_size; i++)
+            idle_loop_cycles += cosmac_opcode_cycles[body[i]];
+    }
+}
 
-    pc += 2;
-    
-    cycles += opcode_cycles - 1;
+#ifdef CHIMP8_PROFILER
+template<TimingMode timing>
+void Chip8::profile_idle_loop(uint64_t iterations) {
+    if (!profiler)
+        return;
+    profiler->skipped_instructions += iterations * idle_loop_opcodes;
+    for (uint64_t i = 0; i < idle_loop_opcodes; i++) {
+        uint16_t address = (idle_loop_start + i * 2) % mem_size;
+        OpcodeId id = decode_opcode_id((memory[address] << 8) | memory[(address + 1) % mem_size]);
+        profiler->opcode_counts[id] += iterations;
+        // Skips aren't taken inside the loop, so only base cycles count
+        if constexpr (timing == TIMING_COSMAC)
+            profiler->opcode_cycles[id] += iterations * cosmac_opcode_cycles[id];
+        profiler->address_counts[address] += iterations;
+    }
+}
+#endif
+
+template<TimingMode timing>
+TraceRecord* Chip8::begin_trace_record(uint8_t* previous_registers) {
+    TraceRecord* record = tracer->next_record();
+    uint16_t address = pc % mem_size;
+    record->cycle = current_cycle<timing>();
+    record->pc = pc;
+    record->opcode = (memory[address] << 8) | memory[(address + 1) % mem_size];
+    record->address_reg = address_reg;
+    record->reg = trace_no_register;
+    record->value = 0;
+    std::memcpy(previous_registers, registers, reg_count);
+    return record;
 }
 
-void Chip8::cycle_delaytimer(int& delay_metatimer) {
-    // 17 ms ~ 60 Hz
-    while (delay_metatimer >= 17) {
-        if (delay_timer != 0)
-            delay_timer -= 1;
-        delay_metatimer -= 17;
+void Chip8::end_trace_record(TraceRecord* record, const uint8_t* previous_registers) {
+    record->address_reg = address_reg;
+    // Compare a word of registers at a time, most opcodes change at most one
+    for (int word = 0; word < reg_count; word += 8) {
+        uint64_t before, after;
+        std::memcpy(&before, previous_registers + word, sizeof(before));
+        std::memcpy(&after, registers + word, sizeof(after));
+        if (before == after)
+            continue;
+        int i = word;
+        while (registers[i] == previous_registers[i])
+            i++;
+        record->reg = i;
+        record->value = registers[i];
+        return;
     }
 }
 
-uint8_t Chip8::cycle_soundtimer(int& sound_metatimer) {
-    // 17 ms ~ 60 Hz
-    while (sound_metatimer >= 17) {
-        if (sound_timer != 0)
-            sound_timer -= 1;
-        sound_metatimer -= 17;
+template<TimingMode timing, bool traced>
+inline void Chip8::execute_opcode() {
+    if ((pc & 1) == 0 && pc < mem_size) {
+        DecodedOpcode& cached = decode_cache[pc >> 1];
+        if (!cached.handler) {
+            // Opcode is 16 bits, big-endian
+            cached = decode_opcode<timing>((memory[pc] << 8) | memory[pc + 1]);
+        }
+        op = &cached;
+    }
+    else {
+        // Misaligned opcodes are rare enough to not be worth caching
+        uncached_op = decode_opcode<timing>((memory[pc % mem_size] << 8) | memory[(pc + 1) % mem_size]);
+        op = &uncached_op;
     }
+    if constexpr (timing == TIMING_COSMAC)
+        opcode_cycles = op->cycles;
+#ifdef CHIMP8_PROFILER
+    uint16_t opcode_address = pc % mem_size;
+#endif
+    uint8_t previous_registers[reg_count];
+    TraceRecord* record;
+    if constexpr (traced)
+        record = begin_trace_record<timing>(previous_registers);
+    (this->*op->handler)();
+    if constexpr (traced)
+        end_trace_record(record, previous_registers);
+    instruction_count++;
+#ifdef CHIMP8_PROFILER
+    if (profiler) {
+        profiler->opcode_counts[op->id]++;
+        if constexpr (timing == TIMING_COSMAC)
+            profiler->opcode_cycles[op->id] += opcode_cycles;
+        profiler->address_counts[opcode_address]++;
+    }
+#endif
+
+    pc += 2;
+}
+
+template<TimingMode timing, bool traced>
+void Chip8::run_engine(uint64_t cycle_count) {
+    // Only a keypress, from outside the engine, can resume execution
+    if (halted_keypress)
+        return;
+
+    // Kept in members so handlers can tell how far into the run they are
+    run_start_instructions = instruction_count;
+    run_length = cycle_count;
+    run_remaining = cycle_count;
+    if constexpr (timing == TIMING_FIXED) {
+        for (uint64_t i = 0; i < cycle_count && !halted_keypress; i++) {
+            execute_opcode<timing, traced>();
+            if (idle_loop_cycles) {
+                // A trace records every opcode executed, so nothing is skipped
+                if constexpr (!traced) {
+                    // Leave the VM as if the skipped iterations had run
+                    uint64_t remaining = cycle_count - i - 1;
+                    uint64_t skipped = remaining / idle_loop_cycles * idle_loop_cycles;
+                    i += skipped;
+                    instruction_count += skipped;
+#ifdef CHIMP8_PROFILER
+                    profile_idle_loop<timing>(skipped / idle_loop_opcodes);
+#endif
+                }
+                idle_loop_cycles = 0;
+            }
+        }
+    }
+    else {
+        // Finish the previous opcode's cycles
+        if ((uint64_t)cycles >= run_remaining) {
+            cycles -= run_remaining;
+            run_remaining = 0;
+            return;
+        }
+        run_remaining -= cycles;
+        cycles = 0;
+
+        // Opcodes run on their first cycle; skip over the remaining ones at once
+        while (run_remaining > 0) {
+            execute_opcode<timing, traced>();
+            if (halted_keypress) {
+                // The remaining cycles only elapse after the keypress
+                cycles = opcode_cycles - 1;
+                run_remaining = 0;
+                return;
+            }
+            if ((uint64_t)opcode_cycles > run_remaining) {
+                cycles = opcode_cycles - run_remaining;
+                run_remaining = 0;
+                idle_loop_cycles = 0;
+                return;
+            }
+            run_remaining -= opcode_cycles;
+            if (idle_loop_cycles) {
+                if constexpr (!traced) {
+                    // Leave the VM as if the skipped iterations had run
+                    uint64_t iterations = run_remaining / idle_loop_cycles;
+                    instruction_count += iterations * idle_loop_opcodes;
+#ifdef CHIMP8_PROFILER
+                    profile_idle_loop<timing>(iterations);
+#endif
+                    run_remaining %= idle_loop_cycles;
+                }
+                idle_loop_cycles = 0;
+            }
+        }
+    }
+}
+
+void Chip8::cycle_vm() {
+    (this->*engine)(1);
+}
+
+void Chip8::run_cycles(uint64_t cycle_count) {
+    (this->*engine)(cycle_count);
+}
+
+// Called by the clock at 60 Hz of emulated time
+void Chip8::cycle_timers() {
+    if (delay_timer != 0)
+        delay_timer -= 1;
+    if (sound_timer != 0)
+        set_sound_timer(sound_timer - 1, clock.get_cycle_count());
+    // The next opcode waits out the display interrupt. While halted in FX0A
+    // the VM isn't counting cycles at all
+    if (timing_mode == TIMING_COSMAC && !halted_keypress)
+        cycles += cosmac_interrupt_cycles;
+}
+
+uint8_t Chip8::get_sound_timer() {
     return sound_timer;
 }
 
+#ifdef CHIMP8_PROFILER
+void Chip8::set_profiler(Profiler* new_profiler) {
+    profiler = new_profiler;
+}
+#endif
+
+void Chip8::set_tracer(Tracer* new_tracer) {
+    tracer = new_tracer;
+    select_engine();
+}
+
+int Chip8::take_sound_edges(SoundEdge* edges) {
+    int count = sound_edge_count;
+    std::memcpy(edges, sound_edges, sizeof(SoundEdge) * count);
+    sound_edge_count = 0;
+    return count;
+}
+
+template<TimingMode timing>
+uint64_t Chip8::current_cycle() {
+    // The clock counts the run once it's over. In fixed timing every opcode
+    // is a cycle, so the instruction count tracks progress for free
+    if constexpr (timing == TIMING_FIXED)
+        return clock.get_cycle_count() + (instruction_count - run_start_instructions);
+    else
+        return clock.get_cycle_count() + (run_length - run_remaining);
+}
+
+void Chip8::set_sound_timer(uint8_t value, uint64_t cycle) {
+    if ((value != 0) != (sound_timer != 0)) {
+        // If nobody is taking edges, keep the latest ones
+        if (sound_edge_count == max_sound_edges) {
+            std::memmove(sound_edges, sound_edges + 1, sizeof(SoundEdge) * (max_sound_edges - 1));
+            sound_edge_count--;
+        }
+        sound_edges[sound_edge_count++] = { cycle, value != 0 };
+    }
+    sound_timer = value;
+}
+
+uint64_t Chip8::get_instruction_count() {
+    return instruction_count;
+}
+
+bool Chip8::is_blocked() {
+    if (delay_timer != 0 || sound_timer != 0)
+        return false;
+    if (halted_keypress)
+        return true;
+    // Many ROMs end on a 1NNN jumping to itself, which never changes anything
+    uint16_t opcode = (memory[pc % mem_size] << 8) | memory[(pc + 1) % mem_size];
+    return opcode == (0x1000 | pc);
+}
+
 void Chip8::on_keypress(int key) {
     keys[key] = true;
     if (halted_keypress) {
@@ -743,8 +1047,20 @@ void Chip8::on_keyrelease(int key) {
     keys[key] = false;
 }
 
-void Chip8::tick(uint64_t delta_time) {
-    clock.tick(delta_time);
+uint64_t Chip8::tick(uint64_t delta_time, uint64_t max_delta_time) {
+    return clock.tick(delta_time, max_delta_time);
+}
+
+void Chip8::run_for(uint64_t cycle_count) {
+    clock.run(cycle_count);
+}
+
+uint64_t Chip8::get_cycle_count() {
+    return clock.get_cycle_count();
+}
+
+uint64_t Chip8::get_cycle_rate() {
+    return clock.get_cycle_rate();
 }
 
 void Chip8::set_cycle_rate(uint64_t new_cycle_rate) {
@@ -758,27 +1074,103 @@ TimingMode Chip8::get_timing_mode() {
 
 void Chip8::set_timing_mode(TimingMode new_timing_mode) {
     timing_mode = new_timing_mode;
-    switch (new_timing_mode) {
-        case TIMING_FIXED:
-            opcode_cycles = 1;
-            break;
-        case TIMING_COSMAC:
-            clock.set_cycle_rate(cosmac_cycle_rate);
-            // Define opcode_cycles for sanity even though it should be replaced
-            opcode_cycles = 1;
-            break;
-    }
+    if (new_timing_mode == TIMING_COSMAC)
+        clock.set_cycle_rate(cosmac_cycle_rate);
+    select_engine();
+    opcode_cycles = 1;
     cycles = 0;
+    // Cached handlers are specialized for the previous timing mode
+    invalidate_decode_cache();
+}
+
+void Chip8::select_engine() {
+    // The untraced engines carry no tracing code at all
+    if (timing_mode == TIMING_FIXED)
+        engine = tracer ? &Chip8::run_engine<TIMING_FIXED, true> : &Chip8::run_engine<TIMING_FIXED, false>;
+    else
+        engine = tracer ? &Chip8::run_engine<TIMING_COSMAC, true> : &Chip8::run_engine<TIMING_COSMAC, false>;
 }
 
 bool Chip8::get_display_pixel(int i) {
-    return display[i];
+    int x = i % screen_w;
+    const uint64_t* row = display[i / screen_w];
+    return (row[x / 64] >> (63 - x % 64)) & 1;
+}
+
+const Chip8State& Chip8::get_state() {
+    return *this;
+}
+
+const uint64_t* Chip8::get_display_row(int row) {
+    return display[row];
+}
+
+uint64_t Chip8::get_display_generation() {
+    return display_generation;
+}
+
+uint64_t Chip8::take_dirty_rows() {
+    uint64_t rows = dirty_rows;
+    dirty_rows = 0;
+    return rows;
+}
+
+void Chip8::mark_display_dirty(uint64_t rows) {
+    dirty_rows |= rows;
+    display_generation++;
 }
 
 bool Chip8::was_exit_opcode_called() {
     return exit_opcode_called;
 }
 
+void Chip8::seed_random(uint64_t seed) {
+    random_state = seed;
+}
+
+// SplitMix64
+uint64_t Chip8::next_random() {
+    random_state += 0x9E3779B97F4A7C15;
+    uint64_t z = random_state;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+    return z ^ (z >> 31);
+}
+
+void Chip8::save_snapshot(Chip8Snapshot& snapshot) {
+    snapshot.magic = snapshot_magic;
+    snapshot.version = snapshot_version;
+    snapshot.size = sizeof(Chip8Snapshot);
+    snapshot.reserved = 0;
+    snapshot.vm = *this;
+    snapshot.clock = clock.get_state();
+}
+
+bool Chip8::load_snapshot(const Chip8Snapshot& snapshot) {
+    if (snapshot.magic != snapshot_magic || snapshot.version != snapshot_version
+        || snapshot.size != sizeof(Chip8Snapshot))
+        return false;
+    // Fields used as indices or divisors must be in range, or a crafted file
+    // could make the VM read and write outside its own state
+    const Chip8State& vm = snapshot.vm;
+    if (vm.sp > stack_depth || vm.keypress_store_reg < 0 || vm.keypress_store_reg >= reg_count
+        || (vm.timing_mode != TIMING_FIXED && vm.timing_mode != TIMING_COSMAC)
+        || snapshot.clock.cycle_rate == 0)
+        return false;
+    uint8_t previous_sound_timer = sound_timer;
+    Chip8State::operator=(snapshot.vm);
+    dirty_pages = ~(uint64_t)0;
+    clock.set_state(snapshot.clock);
+    // Time may have jumped, so stop or start the sound at the restored cycle
+    uint8_t restored_sound_timer = sound_timer;
+    sound_timer = previous_sound_timer;
+    set_sound_timer(restored_sound_timer, clock.get_cycle_count());
+    select_engine();
+    invalidate_decode_cache();
+    mark_display_dirty(all_display_rows);
+    return true;
+}
+
 bool Chip8::get_legacy_shift() {
     return legacy_shift;
 }
@@ -795,26 +1187,9 @@ void Chip8::set_legacy_memops(bool enabled) {
     legacy_memops = enabled;
 }
 
-// Draw display pixel, adjusted for lo/hi-res (draw 2x2 pixel in lo-res)
-void Chip8::draw_display_pixel(int x, int y, bool pixel, int* collision_count) {
-    for (int ny = hi_res ? y : y*2; ny <= (hi_res ? y : y*2+1); ny++) {
-        bool row_collided = false;
-        for (int nx = hi_res ? x : x*2; nx <= (hi_res ? x : x*2+1); nx++) {
-            int screen_coord = nx % screen_w + (ny % screen_h)*screen_w;
-            if (ny >= screen_h && hi_res && !row_collided) {
-                row_collided = true;
-                registers[0xF]++;
-            }
-            if (display[screen_coord] && !(display[screen_coord] ^ pixel) && !row_collided) {
-                row_collided = true;
-                if (hi_res)
-                    registers[0xF]++;
-                else
-                    registers[0xF] = 1;
-            }
-            if (display[screen_coord] && pixel)
-                *(collision_count)++;
-            display[screen_coord] ^= pixel;
-        }
-    }
+bool Chip8::draw_sprite_row(int row, uint64_t bits, int width, int x) {
+    bool collided = xor_sprite_row(display[row], bits, width, x);
+    if (bits)
+        mark_display_dirty((uint64_t)1 << row);
+    return collided;
 }
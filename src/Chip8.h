@@ -3,8 +3,15 @@
 
 #include <cstdint>
 #include <cstddef>
+#include <type_traits>
 #include "Clock.h"
 
+#ifdef CHIMP8_PROFILER
+struct Profiler;
+#endif
+class Tracer;
+struct TraceRecord;
+
 constexpr int mem_size = 4096;
 constexpr int reg_count = 16;
 constexpr int stack_depth = 16;
@@ -12,8 +19,21 @@ constexpr int key_count = 16;
 constexpr int screen_w = 128;
 constexpr int screen_h = 64;
 constexpr int screen_size = screen_w * screen_h;
+// Display rows are packed into 64-bit words, leftmost pixel in the most significant bit
+constexpr int display_row_words = screen_w / 64;
+// Bitmap of display rows, bit N for row N
+constexpr uint64_t all_display_rows = ~(uint64_t)0;
+static_assert(screen_h <= 64, "Dirty display rows must fit in a 64-bit bitmap");
 constexpr int font_address = 0x50;
 constexpr int fontset_size = 80;
+// One decoded opcode per even address
+constexpr int decode_cache_size = mem_size / 2;
+// Memory is restored by reset in pages of this many bytes, those written since
+// the reset point only
+constexpr int reset_page_size = 64;
+static_assert(mem_size / reset_page_size <= 64, "Dirty memory pages must fit in a 64-bit bitmap");
+// Bytes from the start of an idle loop to the jump closing it, at most
+constexpr int max_idle_loop_size = 4;
 
 constexpr uint8_t chip8_fontset[fontset_size] =
 {
@@ -35,42 +55,40 @@ constexpr uint8_t chip8_fontset[fontset_size] =
     0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
+// Sound edges buffered between calls to take_sound_edges
+constexpr int max_sound_edges = 64;
+
+// The sound timer starting or stopping, at an emulated cycle
+struct SoundEdge {
+    uint64_t cycle;
+    bool on;
+};
+
 enum TimingMode {
     TIMING_FIXED,
     TIMING_COSMAC,
 };
 
-class Chip8 {
-public:
-    Chip8();
-
-    void load_rom(void* rom_file, size_t rom_size);
-    void cycle_vm();
-    void cycle_delaytimer(int& delay_metatimer);
-    uint8_t cycle_soundtimer(int& sound_metatimer);
-    void on_keypress(int key);
-    void on_keyrelease(int key);
-
-    void tick(uint64_t delta_time);
-    void set_cycle_rate(uint64_t new_cycle_rate);
-    TimingMode get_timing_mode();
-    void set_timing_mode(TimingMode new_timing_mode);
-
-    bool get_display_pixel(int i);
-    bool was_exit_opcode_called();
-    bool get_legacy_shift();
-    bool get_legacy_memops();
-    void set_legacy_shift(bool enabled);
-    void set_legacy_memops(bool enabled);
-
-    typedef void(Chip8::*opcode_ptr)();
-private:
-    Clock clock;
-    int opcode_cycles;
-    TimingMode timing_mode;
-    int cycles = 0;
+// Identifies the handler for each opcode
+enum OpcodeId {
+    OPCODE_NOP,
+    OPCODE_00CN, OPCODE_00E0, OPCODE_00EE, OPCODE_00FB,
+    OPCODE_00FC, OPCODE_00FD, OPCODE_00FE, OPCODE_00FF,
+    OPCODE_1NNN, OPCODE_2NNN, OPCODE_3XNN, OPCODE_4XNN,
+    OPCODE_5XY0, OPCODE_6XNN, OPCODE_7XNN,
+    OPCODE_8XY0, OPCODE_8XY1, OPCODE_8XY2, OPCODE_8XY3,
+    OPCODE_8XY4, OPCODE_8XY5, OPCODE_8XY6, OPCODE_8XY7,
+    OPCODE_8XYE, OPCODE_9XY0, OPCODE_ANNN, OPCODE_BNNN,
+    OPCODE_CXNN, OPCODE_DXYN, OPCODE_EX9E, OPCODE_EXA1,
+    OPCODE_FX07, OPCODE_FX0A, OPCODE_FX15, OPCODE_FX18,
+    OPCODE_FX1E, OPCODE_FX29, OPCODE_FX33, OPCODE_FX55,
+    OPCODE_FX65,
+    OPCODE_COUNT,
+};
 
-    uint16_t opcode;
+// Everything that decides how the VM runs from here on, kept trivially
+// copyable so that a snapshot is a single copy
+struct Chip8State {
     uint8_t memory[mem_size];
     uint8_t registers[reg_count];
     // 'I' register
@@ -83,7 +101,7 @@ private:
     uint8_t delay_timer;
     uint8_t sound_timer;
     bool keys[key_count];
-    bool display[screen_size];
+    uint64_t display[screen_h][display_row_words];
 
     // This is for blocking opcode FX0A
     bool halted_keypress;
@@ -99,11 +117,195 @@ private:
     bool legacy_shift;
     // Flag for original CHIP-8 FX55 and FX65 opcode behavior (if false, use SCHIP behavior)
     bool legacy_memops;
+    // Per-VM random number generator state, so runs can be reproduced from a seed
+    uint64_t random_state;
+
+    TimingMode timing_mode;
+    // Cycles taken by the last opcode (COSMAC timing only)
+    int opcode_cycles;
+    // Cycles left until the next opcode runs (COSMAC timing only)
+    int cycles;
+};
+
+constexpr uint32_t snapshot_magic = 0x50414E53; // "SNAP"
+// Bump when Chip8State or ClockState change
+constexpr uint32_t snapshot_version = 1;
+
+static_assert(std::is_trivially_copyable<Chip8State>::value, "Chip8State must be copyable as bytes");
+
+// Self-describing snapshot, written to disk as is
+struct Chip8Snapshot {
+    uint32_t magic;
+    uint32_t version;
+    // sizeof(Chip8Snapshot), catches layout differences between builds
+    uint32_t size;
+    uint32_t reserved;
+    Chip8State vm;
+    ClockState clock;
+};
+
+class Chip8 : private Chip8State {
+public:
+    Chip8();
+
+    void load_rom(const void* rom_file, size_t rom_size);
+    // Make the current state the one reset returns to. A new VM's reset
+    // point is its initial state, before any ROM is loaded
+    void set_reset_point();
+    // Return to the reset point, e.g. to run another ROM or input from
+    // scratch. Only copies back the memory written since, so it's cheap
+    // enough to call for every run
+    void reset();
+    // Run cycles without advancing the clock or timers
+    void cycle_vm();
+    void run_cycles(uint64_t cycle_count);
+    // Decrement the delay and sound timers
+    void cycle_timers();
+    uint8_t get_sound_timer();
+#ifdef CHIMP8_PROFILER
+    // Count execution statistics into profiler, or stop if NULL
+    void set_profiler(Profiler* new_profiler);
+#endif
+    // Record every opcode executed into tracer, or stop if NULL
+    void set_tracer(Tracer* new_tracer);
+    // Copy the sound edges since the last call, oldest first, into edges
+    // (max_sound_edges long). Returns how many there were
+    int take_sound_edges(SoundEdge* edges);
+    // Whether nothing can change until a key is pressed: the VM is waiting in
+    // FX0A or jumping to itself, with both timers stopped
+    bool is_blocked();
+    void on_keypress(int key);
+    void on_keyrelease(int key);
+
+    // Run for host time, in nanoseconds, up to max_delta_time
+    uint64_t tick(uint64_t delta_time, uint64_t max_delta_time);
+    // Run for exactly cycle_count cycles of emulated time
+    void run_for(uint64_t cycle_count);
+    uint64_t get_cycle_count();
+    uint64_t get_instruction_count();
+    uint64_t get_cycle_rate();
+    void set_cycle_rate(uint64_t new_cycle_rate);
+    TimingMode get_timing_mode();
+    void set_timing_mode(TimingMode new_timing_mode);
+
+    bool get_display_pixel(int i);
+    // Packed row of display_row_words words
+    const uint64_t* get_display_row(int row);
+    // Incremented whenever the display changes
+    uint64_t get_display_generation();
+    // Bitmap of rows changed since the last call
+    uint64_t take_dirty_rows();
+    bool was_exit_opcode_called();
+    // Restart the sequence of random numbers used by CXNN
+    void seed_random(uint64_t seed);
+    // Capture or restore the whole VM. Restoring fails if the snapshot is
+    // from an incompatible build
+    void save_snapshot(Chip8Snapshot& snapshot);
+    bool load_snapshot(const Chip8Snapshot& snapshot);
+    // Registers, memory and display, without copying them
+    const Chip8State& get_state();
+    bool get_legacy_shift();
+    bool get_legacy_memops();
+    void set_legacy_shift(bool enabled);
+    void set_legacy_memops(bool enabled);
+    // Which handler runs the opcode, OPCODE_NOP if it isn't recognized
+    static OpcodeId decode_opcode_id(uint16_t opcode);
+
+    typedef void(Chip8::*opcode_ptr)();
+    typedef void(Chip8::*engine_ptr)(uint64_t);
+private:
+    // Opcode with its handler resolved and operands extracted, so that
+    // cycle_vm doesn't need to decode it again while it's unchanged in memory
+    struct DecodedOpcode {
+        // NULL if not decoded yet
+        opcode_ptr handler;
+        // Base COSMAC VIP cycles
+        uint16_t cycles;
+        uint16_t nnn;
+        uint8_t x;
+        uint8_t y;
+        uint8_t n;
+        uint8_t nn;
+#ifdef CHIMP8_PROFILER
+        OpcodeId id;
+#endif
+    };
+
+    Clock clock;
+    // Execution loop specialized for timing_mode, and whether it's traced
+    engine_ptr engine;
+    Tracer* tracer;
+
+    // Opcode being executed
+    const DecodedOpcode* op;
+    // Holds the opcode being executed when it's not cacheable (odd address)
+    DecodedOpcode uncached_op;
+    // Cycles per iteration of the idle loop just detected, 0 if none
+    uint64_t idle_loop_cycles;
+    uint64_t idle_loop_opcodes;
+    uint16_t idle_loop_start;
+    // Progress of the engine run in progress. Fixed timing counts opcodes
+    // since run_start_instructions, COSMAC timing cycles left in run_length
+    uint64_t run_start_instructions;
+    uint64_t run_length;
+    uint64_t run_remaining;
+    SoundEdge sound_edges[max_sound_edges];
+    int sound_edge_count;
+#ifdef CHIMP8_PROFILER
+    Profiler* profiler;
+#endif
+    // Opcodes executed, including skipped idle loop iterations. Statistics
+    // only, so not part of the saved state
+    uint64_t instruction_count;
+    DecodedOpcode decode_cache[decode_cache_size];
+    uint64_t display_generation;
+    uint64_t dirty_rows;
+    // State to return to on reset
+    Chip8State reset_state;
+    ClockState reset_clock;
+    uint64_t reset_instruction_count;
+    // Bit N set if memory page N (reset_page_size bytes) changed since the reset point
+    uint64_t dirty_pages;
+
+    template<TimingMode timing>
+    static DecodedOpcode decode_opcode(uint16_t opcode);
+    void invalidate_decode_cache();
+    // Invalidate cached opcodes and mark pages dirty for writes to memory, from begin to end
+    void mark_memory_written(int begin, int end);
+
+    bool is_waiting_skip(uint16_t opcode);
+    template<TimingMode timing>
+    void detect_idle_loop(uint16_t loop_start);
+#ifdef CHIMP8_PROFILER
+    // Count skipped iterations of the idle loop as if its opcodes had run
+    template<TimingMode timing>
+    void profile_idle_loop(uint64_t iterations);
+#endif
+    template<TimingMode timing, bool traced>
+    void execute_opcode();
+    template<TimingMode timing, bool traced>
+    void run_engine(uint64_t cycle_count);
+    void select_engine();
+    // Fill in a trace record before and after the opcode runs, so that
+    // the opcode is traced even if it throws
+    template<TimingMode timing>
+    TraceRecord* begin_trace_record(uint8_t* previous_registers);
+    void end_trace_record(TraceRecord* record, const uint8_t* previous_registers);
+    // Write to memory, invalidating any cached opcode at that address
+    void write_memory(uint16_t address, uint8_t value);
 
-    // Draw display pixel, adjusted for lo/hi-res (draw 2x2 pixel in lo-res)
-    void draw_display_pixel(int x, int y, bool v, int* collision_count);
+    void mark_display_dirty(uint64_t rows);
+    // Cycle the executing opcode started on
+    template<TimingMode timing>
+    uint64_t current_cycle();
+    // Set the sound timer, recording an edge if the sound starts or stops
+    void set_sound_timer(uint8_t value, uint64_t cycle);
+    uint64_t next_random();
+    // XOR a row of sprite pixels onto the display, returns whether there was a collision
+    bool draw_sprite_row(int row, uint64_t bits, int width, int x);
 
     // Opcodes
+    void opcode_nop();
     void opcode_00CN();
     void opcode_00E0();
     void opcode_00EE();
@@ -112,10 +314,14 @@ private:
     void opcode_00FD();
     void opcode_00FE();
     void opcode_00FF();
+    template<TimingMode timing>
     void opcode_1NNN();
     void opcode_2NNN();
+    template<TimingMode timing>
     void opcode_3XNN();
+    template<TimingMode timing>
     void opcode_4XNN();
+    template<TimingMode timing>
     void opcode_5XY0();
     void opcode_6XNN();
     void opcode_7XNN();
@@ -128,29 +334,41 @@ private:
     void opcode_8XY6();
     void opcode_8XY7();
     void opcode_8XYE();
+    template<TimingMode timing>
     void opcode_9XY0();
     void opcode_ANNN();
+    template<TimingMode timing>
     void opcode_BNNN();
     void opcode_CXNN();
+    template<TimingMode timing>
     void opcode_DXYN();
+    template<TimingMode timing>
     void opcode_EX9E();
+    template<TimingMode timing>
     void opcode_EXA1();
     void opcode_FX07();
     void opcode_FX0A();
     void opcode_FX15();
+    template<TimingMode timing>
     void opcode_FX18();
+    template<TimingMode timing>
     void opcode_FX1E();
     void opcode_FX29();
+    template<TimingMode timing>
     void opcode_FX33();
+    template<TimingMode timing>
     void opcode_FX55();
+    template<TimingMode timing>
     void opcode_FX65();
 
-    // Opcode function pointers
-    void opcode_00yx();
-    void opcode_8XYx();
-    void opcode_EXxy();
-    void opcode_FXxy();
-    static opcode_ptr opcode_funcs[16];
+    // Opcode decoding
+    static OpcodeId decode_00yx(uint16_t opcode);
+    static OpcodeId decode_8XYx(uint16_t opcode);
+    static OpcodeId decode_EXxy(uint16_t opcode);
+    static OpcodeId decode_FXxy(uint16_t opcode);
+    static const OpcodeId opcode_ids[16];
+    template<TimingMode timing>
+    static const opcode_ptr opcode_handlers[OPCODE_COUNT];
 };
 
 #endif
@@ -0,0 +1,542 @@
+#include "Chip8Batch.h"
+#include <algorithm>
+#include <cstring>
+#include "Display.h"
+
+// Addresses wrap around memory
+constexpr uint16_t address_mask = mem_size - 1;
+constexpr size_t display_words = screen_h * display_row_words;
+
+// Every opcode decoded ahead of time, since instances that diverge are
+// stepped one at a time and a Chip8 decode cache per instance would be too big
+static const std::vector<uint8_t> opcode_id_table = [] {
+    std::vector<uint8_t> table(0x10000);
+    for (size_t opcode = 0; opcode < table.size(); opcode++)
+        table[opcode] = Chip8::decode_opcode_id(opcode);
+    return table;
+}();
+
+Chip8Batch::Chip8Batch(size_t instance_count)
+    : count(instance_count), registers(reg_count * instance_count), stack(stack_depth * instance_count),
+    sp(instance_count), pc(instance_count), address_reg(instance_count), delay_timer(instance_count),
+    sound_timer(instance_count), keys(instance_count), status(instance_count),
+    keypress_store_reg(instance_count), hi_res(instance_count), random_state(instance_count),
+    memory(mem_size * instance_count), display(display_words * instance_count) {
+    clock.cycle_rate = default_cycle_rate;
+    clock.time_remainder = 0;
+    clock.timer_phase = 0;
+    clock.cycle_count = 0;
+    load_rom(NULL, 0);
+}
+
+size_t Chip8Batch::get_instance_count() {
+    return count;
+}
+
+void Chip8Batch::load_rom(const void* rom, size_t rom_size) {
+    std::fill(registers.begin(), registers.end(), 0);
+    std::fill(stack.begin(), stack.end(), 0);
+    std::fill(sp.begin(), sp.end(), 0);
+    std::fill(pc.begin(), pc.end(), 0x200);
+    std::fill(address_reg.begin(), address_reg.end(), 0);
+    std::fill(delay_timer.begin(), delay_timer.end(), 0);
+    std::fill(sound_timer.begin(), sound_timer.end(), 0);
+    std::fill(keys.begin(), keys.end(), 0);
+    std::fill(status.begin(), status.end(), BATCH_RUNNING);
+    std::fill(keypress_store_reg.begin(), keypress_store_reg.end(), 0);
+    std::fill(hi_res.begin(), hi_res.end(), 0);
+    std::fill(random_state.begin(), random_state.end(), 0);
+    std::fill(display.begin(), display.end(), 0);
+
+    rom_size = std::min(rom_size, (size_t)(mem_size - 0x200));
+    for (size_t i = 0; i < count; i++) {
+        uint8_t* instance_memory = &memory[i * mem_size];
+        std::memset(instance_memory, 0, mem_size);
+        std::memcpy(instance_memory + font_address, chip8_fontset, fontset_size);
+        if (rom_size > 0)
+            std::memcpy(instance_memory + 0x200, rom, rom_size);
+    }
+}
+
+void Chip8Batch::seed_random(size_t instance, uint64_t seed) {
+    random_state[instance] = seed;
+}
+
+void Chip8Batch::set_cycle_rate(uint64_t new_cycle_rate) {
+    new_cycle_rate = std::max<uint64_t>(new_cycle_rate, 1);
+    // Keep the same progress towards the next timer decrement, like Clock
+    clock.timer_phase = clock.timer_phase * new_cycle_rate / clock.cycle_rate;
+    clock.cycle_rate = new_cycle_rate;
+}
+
+uint64_t Chip8Batch::get_cycle_rate() {
+    return clock.cycle_rate;
+}
+
+void Chip8Batch::set_legacy_shift(bool enabled) {
+    legacy_shift = enabled;
+}
+
+void Chip8Batch::set_legacy_memops(bool enabled) {
+    legacy_memops = enabled;
+}
+
+void Chip8Batch::on_keypress(size_t instance, int key) {
+    keys[instance] |= 1 << key;
+    if (status[instance] == BATCH_WAITING_KEY) {
+        status[instance] = BATCH_RUNNING;
+        registers_of(keypress_store_reg[instance])[instance] = key;
+    }
+}
+
+void Chip8Batch::on_keyrelease(size_t instance, int key) {
+    keys[instance] &= ~(1 << key);
+}
+
+void Chip8Batch::run_for(uint64_t cycle_count, ThreadPool* pool) {
+    // Instances never affect each other, so each group runs the whole time on its own
+    size_t group_count = (count + group_size - 1) / group_size;
+    auto run = [&](size_t group) {
+        size_t begin = group * group_size;
+        run_group(begin, std::min(begin + group_size, count), cycle_count);
+    };
+    if (pool)
+        pool->parallel_for(group_count, run);
+    else {
+        for (size_t group = 0; group < group_count; group++)
+            run(group);
+    }
+    clock.cycle_count += cycle_count;
+    clock.timer_phase = (clock.timer_phase + cycle_count * timer_rate) % clock.cycle_rate;
+}
+
+uint64_t Chip8Batch::get_cycle_count() {
+    return clock.cycle_count;
+}
+
+BatchStatus Chip8Batch::get_status(size_t instance) {
+    return status[instance];
+}
+
+uint16_t Chip8Batch::get_pc(size_t instance) {
+    return pc[instance];
+}
+
+uint16_t Chip8Batch::get_address_reg(size_t instance) {
+    return address_reg[instance];
+}
+
+uint8_t Chip8Batch::get_register(size_t instance, int reg) {
+    return registers_of(reg)[instance];
+}
+
+const uint64_t* Chip8Batch::get_display_row(size_t instance, int row) {
+    return display_of(instance) + row * display_row_words;
+}
+
+void Chip8Batch::run_group(size_t begin, size_t end, uint64_t cycle_count) {
+    // Timers decrement at the same cycles as with Clock::run
+    uint64_t timer_phase = clock.timer_phase;
+    while (cycle_count > 0) {
+        uint64_t cycles_to_timer = (clock.cycle_rate - timer_phase + timer_rate - 1) / timer_rate;
+        uint64_t cycles_run = std::min(cycle_count, cycles_to_timer);
+        for (uint64_t cycle = 0; cycle < cycles_run; cycle++)
+            step_group(begin, end);
+        cycle_count -= cycles_run;
+
+        timer_phase += cycles_run * timer_rate;
+        while (timer_phase >= clock.cycle_rate) {
+            timer_phase -= clock.cycle_rate;
+            cycle_timers(begin, end);
+        }
+    }
+}
+
+void Chip8Batch::step_group(size_t begin, size_t end) {
+    // Instances started from the same ROM tend to stay at the same address,
+    // in which case they can all run the opcode there together
+    uint16_t group_pc = pc[begin];
+    bool uniform = true;
+    for (size_t i = begin; i < end; i++)
+        uniform &= status[i] == BATCH_RUNNING && pc[i] == group_pc;
+    if (uniform) {
+        // Unless some instance modified its code
+        uint16_t opcode = fetch_opcode(begin, group_pc);
+        for (size_t i = begin + 1; i < end && uniform; i++)
+            uniform = fetch_opcode(i, group_pc) == opcode;
+        if (uniform && step_uniform(begin, end, opcode))
+            return;
+    }
+    for (size_t i = begin; i < end; i++) {
+        if (status[i] == BATCH_RUNNING)
+            step_instance(i, fetch_opcode(i, pc[i]));
+    }
+}
+
+// Same behavior as step_instance, written as loops over the instances that
+// the compiler can vectorize
+bool Chip8Batch::step_uniform(size_t begin, size_t end, uint16_t opcode) {
+    int x = (opcode & 0x0F00) >> 8;
+    int y = (opcode & 0x00F0) >> 4;
+    uint8_t nn = opcode & 0x00FF;
+    uint16_t nnn = opcode & 0x0FFF;
+    uint8_t* vx = registers_of(x);
+    uint8_t* vy = registers_of(y);
+    uint8_t* vf = registers_of(0xF);
+    uint16_t* instance_pc = pc.data();
+    uint16_t* instance_i = address_reg.data();
+    uint8_t* instance_delay_timer = delay_timer.data();
+    uint8_t* instance_sound_timer = sound_timer.data();
+    switch (Chip8::decode_opcode_id(opcode)) {
+        case OPCODE_1NNN:
+            for (size_t i = begin; i < end; i++)
+                instance_pc[i] = nnn - 2;
+            break;
+        case OPCODE_3XNN:
+            for (size_t i = begin; i < end; i++)
+                instance_pc[i] += (vx[i] == nn) * 2;
+            break;
+        case OPCODE_4XNN:
+            for (size_t i = begin; i < end; i++)
+                instance_pc[i] += (vx[i] != nn) * 2;
+            break;
+        case OPCODE_5XY0:
+            for (size_t i = begin; i < end; i++)
+                instance_pc[i] += (vx[i] == vy[i]) * 2;
+            break;
+        case OPCODE_6XNN:
+            for (size_t i = begin; i < end; i++)
+                vx[i] = nn;
+            break;
+        case OPCODE_7XNN:
+            for (size_t i = begin; i < end; i++)
+                vx[i] += nn;
+            break;
+        case OPCODE_8XY0:
+            for (size_t i = begin; i < end; i++)
+                vx[i] = vy[i];
+            break;
+        case OPCODE_8XY1:
+            for (size_t i = begin; i < end; i++)
+                vx[i] |= vy[i];
+            break;
+        case OPCODE_8XY2:
+            for (size_t i = begin; i < end; i++)
+                vx[i] &= vy[i];
+            break;
+        case OPCODE_8XY3:
+            for (size_t i = begin; i < end; i++)
+                vx[i] ^= vy[i];
+            break;
+        case OPCODE_8XY4:
+            for (size_t i = begin; i < end; i++) {
+                vf[i] = (uint16_t)vx[i] + (uint16_t)vy[i] > 255;
+                vx[i] += vy[i];
+            }
+            break;
+        case OPCODE_8XY5:
+            for (size_t i = begin; i < end; i++) {
+                vf[i] = vy[i] <= vx[i];
+                vx[i] -= vy[i];
+            }
+            break;
+        case OPCODE_8XY7:
+            for (size_t i = begin; i < end; i++) {
+                vf[i] = vx[i] <= vy[i];
+                vx[i] = vy[i] - vx[i];
+            }
+            break;
+        case OPCODE_9XY0:
+            for (size_t i = begin; i < end; i++)
+                instance_pc[i] += (vx[i] != vy[i]) * 2;
+            break;
+        case OPCODE_ANNN:
+            for (size_t i = begin; i < end; i++)
+                instance_i[i] = nnn;
+            break;
+        case OPCODE_FX07:
+            for (size_t i = begin; i < end; i++)
+                vx[i] = instance_delay_timer[i];
+            break;
+        case OPCODE_FX15:
+            for (size_t i = begin; i < end; i++)
+                instance_delay_timer[i] = vx[i];
+            break;
+        case OPCODE_FX18:
+            for (size_t i = begin; i < end; i++)
+                instance_sound_timer[i] = vx[i];
+            break;
+        case OPCODE_FX1E:
+            for (size_t i = begin; i < end; i++)
+                instance_i[i] += vx[i];
+            break;
+        case OPCODE_FX29:
+            for (size_t i = begin; i < end; i++)
+                instance_i[i] = font_address + vx[i] * 5;
+            break;
+        default:
+            return false;
+    }
+    for (size_t i = begin; i < end; i++)
+        instance_pc[i] += 2;
+    return true;
+}
+
+// Same behavior as Chip8's opcode handlers in fixed timing, except that
+// memory accesses wrap around instead of running past the end
+void Chip8Batch::step_instance(size_t i, uint16_t opcode) {
+    int x = (opcode & 0x0F00) >> 8;
+    int y = (opcode & 0x00F0) >> 4;
+    int n = opcode & 0x000F;
+    uint8_t nn = opcode & 0x00FF;
+    uint16_t nnn = opcode & 0x0FFF;
+    uint8_t& vx = registers_of(x)[i];
+    uint8_t& vy = registers_of(y)[i];
+    uint8_t& vf = registers_of(0xF)[i];
+    uint8_t* instance_memory = &memory[i * mem_size];
+    uint64_t* instance_display = display_of(i);
+    uint16_t& I = address_reg[i];
+    switch (opcode_id_table[opcode]) {
+        case OPCODE_00CN:
+            std::memmove(instance_display + n * display_row_words, instance_display,
+                sizeof(uint64_t) * display_row_words * (screen_h - n));
+            std::memset(instance_display, 0, sizeof(uint64_t) * display_row_words * n);
+            break;
+        case OPCODE_00E0:
+            std::memset(instance_display, 0, sizeof(uint64_t) * display_words);
+            break;
+        case OPCODE_00EE:
+            if (sp[i] == 0) {
+                status[i] = BATCH_FAULTED;
+                return;
+            }
+            sp[i]--;
+            pc[i] = stack[sp[i] * count + i];
+            break;
+        case OPCODE_00FB:
+            for (int row = 0; row < screen_h; row++) {
+                uint64_t* words = instance_display + row * display_row_words;
+                words[1] = (words[1] >> 4) | (words[0] << 60);
+                words[0] >>= 4;
+            }
+            break;
+        case OPCODE_00FC:
+            for (int row = 0; row < screen_h; row++) {
+                uint64_t* words = instance_display + row * display_row_words;
+                words[0] = (words[0] << 4) | (words[1] >> 60);
+                words[1] <<= 4;
+            }
+            break;
+        case OPCODE_00FD:
+            status[i] = BATCH_EXITED;
+            break;
+        case OPCODE_00FE:
+            hi_res[i] = false;
+            break;
+        case OPCODE_00FF:
+            hi_res[i] = true;
+            break;
+        case OPCODE_1NNN:
+            pc[i] = nnn - 2;
+            break;
+        case OPCODE_2NNN:
+            if (sp[i] >= stack_depth) {
+                status[i] = BATCH_FAULTED;
+                return;
+            }
+            stack[sp[i] * count + i] = pc[i];
+            sp[i]++;
+            pc[i] = nnn - 2;
+            break;
+        case OPCODE_3XNN:
+            if (vx == nn)
+                pc[i] += 2;
+            break;
+        case OPCODE_4XNN:
+            if (vx != nn)
+                pc[i] += 2;
+            break;
+        case OPCODE_5XY0:
+            if (vx == vy)
+                pc[i] += 2;
+            break;
+        case OPCODE_6XNN:
+            vx = nn;
+            break;
+        case OPCODE_7XNN:
+            vx += nn;
+            break;
+        case OPCODE_8XY0:
+            vx = vy;
+            break;
+        case OPCODE_8XY1:
+            vx |= vy;
+            break;
+        case OPCODE_8XY2:
+            vx &= vy;
+            break;
+        case OPCODE_8XY3:
+            vx ^= vy;
+            break;
+        case OPCODE_8XY4:
+            vf = (uint16_t)vx + (uint16_t)vy > 255;
+            vx += vy;
+            break;
+        case OPCODE_8XY5:
+            vf = vy <= vx;
+            vx -= vy;
+            break;
+        case OPCODE_8XY6:
+            if (legacy_shift) {
+                vf = vy & 0x1;
+                vy >>= 1;
+                vx = vy;
+            }
+            else {
+                vf = vx & 0x1;
+                vx >>= 1;
+            }
+            break;
+        case OPCODE_8XY7:
+            vf = vx <= vy;
+            vx = vy - vx;
+            break;
+        case OPCODE_8XYE:
+            if (legacy_shift) {
+                vf = (vy & 0x80) >> 7;
+                vy <<= 1;
+                vx = vy;
+            }
+            else {
+                vf = (vx & 0x80) >> 7;
+                vx <<= 1;
+            }
+            break;
+        case OPCODE_9XY0:
+            if (vx != vy)
+                pc[i] += 2;
+            break;
+        case OPCODE_ANNN:
+            I = nnn;
+            break;
+        case OPCODE_BNNN:
+            pc[i] = nnn + registers_of(0)[i] - 2;
+            break;
+        case OPCODE_CXNN: {
+            // SplitMix64, like Chip8::next_random
+            uint64_t z = random_state[i] += 0x9E3779B97F4A7C15;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+            vx = (uint8_t)((z ^ (z >> 31)) >> 56) & nn;
+            break;
+        }
+        case OPCODE_DXYN:
+            draw_sprite(i, x, y, n);
+            break;
+        case OPCODE_EX9E:
+            if ((keys[i] >> (vx % key_count)) & 1)
+                pc[i] += 2;
+            break;
+        case OPCODE_EXA1:
+            if (!((keys[i] >> (vx % key_count)) & 1))
+                pc[i] += 2;
+            break;
+        case OPCODE_FX07:
+            vx = delay_timer[i];
+            break;
+        case OPCODE_FX0A:
+            keypress_store_reg[i] = x;
+            status[i] = BATCH_WAITING_KEY;
+            break;
+        case OPCODE_FX15:
+            delay_timer[i] = vx;
+            break;
+        case OPCODE_FX18:
+            sound_timer[i] = vx;
+            break;
+        case OPCODE_FX1E:
+            I += vx;
+            break;
+        case OPCODE_FX29:
+            I = font_address + vx * 5;
+            break;
+        case OPCODE_FX33:
+            instance_memory[I & address_mask] = vx / 100;
+            instance_memory[(I + 1) & address_mask] = (vx / 10) % 10;
+            instance_memory[(I + 2) & address_mask] = vx % 10;
+            break;
+        case OPCODE_FX55:
+            for (int reg = 0; reg <= x; reg++) {
+                uint16_t address = legacy_memops ? I++ : I + reg;
+                instance_memory[address & address_mask] = registers_of(reg)[i];
+            }
+            break;
+        case OPCODE_FX65:
+            for (int reg = 0; reg <= x; reg++) {
+                uint16_t address = legacy_memops ? I++ : I + reg;
+                registers_of(reg)[i] = instance_memory[address & address_mask];
+            }
+            break;
+        default:
+            break;
+    }
+    pc[i] += 2;
+}
+
+// Like Chip8::opcode_DXYN
+void Chip8Batch::draw_sprite(size_t i, int x, int y, int n) {
+    uint8_t* instance_memory = &memory[i * mem_size];
+    uint64_t* instance_display = display_of(i);
+    uint8_t& vf = registers_of(0xF)[i];
+    uint8_t vx = registers_of(x)[i] % screen_w;
+    uint8_t vy = registers_of(y)[i] % screen_h;
+    uint16_t I = address_reg[i];
+    bool wide = false;
+    if (n == 0 && hi_res[i]) {
+        n = 16;
+        wide = true;
+    }
+
+    vf = 0;
+    for (int row = 0; row < n; row++) {
+        if (hi_res[i]) {
+            uint16_t bits = instance_memory[I++ & address_mask];
+            if (wide)
+                bits = (bits << 8) | instance_memory[I++ & address_mask];
+            uint64_t* words = instance_display + ((vy + row) % screen_h) * display_row_words;
+            if (xor_sprite_row(words, bits, wide ? 16 : 8, vx) || vy + row >= screen_h)
+                vf++;
+        }
+        else {
+            // Each pixel is 2x2 in lo-res
+            uint16_t bits = lores_doubled_bits[instance_memory[I++ & address_mask]];
+            int screen_x = (vx * 2) % screen_w;
+            int screen_y = ((vy + row) * 2) % screen_h;
+            uint64_t* words = instance_display + screen_y * display_row_words;
+            bool collided = xor_sprite_row(words, bits, 16, screen_x);
+            collided |= xor_sprite_row(words + display_row_words, bits, 16, screen_x);
+            if (collided)
+                vf = 1;
+        }
+    }
+}
+
+void Chip8Batch::cycle_timers(size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+        delay_timer[i] -= delay_timer[i] != 0;
+        sound_timer[i] -= sound_timer[i] != 0;
+    }
+}
+
+uint16_t Chip8Batch::fetch_opcode(size_t instance, uint16_t address) {
+    const uint8_t* instance_memory = &memory[instance * mem_size];
+    return (instance_memory[address & address_mask] << 8) | instance_memory[(address + 1) & address_mask];
+}
+
+uint8_t* Chip8Batch::registers_of(int reg) {
+    return &registers[reg * count];
+}
+
+uint64_t* Chip8Batch::display_of(size_t instance) {
+    return &display[instance * display_words];
+}
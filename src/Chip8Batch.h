@@ -0,0 +1,97 @@
+// Many VMs stepped in lockstep, for automated play and search
+#ifndef CHIP8BATCH_H
+#define CHIP8BATCH_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "Chip8.h"
+#include "Clock.h"
+#include "ThreadPool.h"
+
+enum BatchStatus : uint8_t {
+    BATCH_RUNNING,
+    // Halted in FX0A until a key is pressed
+    BATCH_WAITING_KEY,
+    // Ran 00FD
+    BATCH_EXITED,
+    // Stack overflow or underflow, which would throw in Chip8
+    BATCH_FAULTED,
+};
+
+// Instances all run the same ROM with fixed timing, one opcode per cycle,
+// so they share one clock and advance together. They behave like a Chip8
+// in TIMING_FIXED, but without sound edges or statistics.
+//
+// State is stored as structure of arrays: each register, the PC, I and the
+// timers are arrays indexed by instance, so stepping a group of instances
+// through the same opcode is a loop over contiguous values. Displays are
+// packed like Chip8's, one after another.
+class Chip8Batch {
+public:
+    explicit Chip8Batch(size_t instance_count);
+    size_t get_instance_count();
+    // Reset every instance and load the ROM into each
+    void load_rom(const void* rom, size_t rom_size);
+    void seed_random(size_t instance, uint64_t seed);
+    void set_cycle_rate(uint64_t new_cycle_rate);
+    uint64_t get_cycle_rate();
+    void set_legacy_shift(bool enabled);
+    void set_legacy_memops(bool enabled);
+    void on_keypress(size_t instance, int key);
+    void on_keyrelease(size_t instance, int key);
+
+    // Run every instance for cycle_count cycles, sharing groups of
+    // instances among the pool's threads if there is one
+    void run_for(uint64_t cycle_count, ThreadPool* pool = NULL);
+    uint64_t get_cycle_count();
+
+    BatchStatus get_status(size_t instance);
+    uint16_t get_pc(size_t instance);
+    uint16_t get_address_reg(size_t instance);
+    uint8_t get_register(size_t instance, int reg);
+    // Packed row of display_row_words words, like Chip8::get_display_row
+    const uint64_t* get_display_row(size_t instance, int row);
+private:
+    // Instances stepped together, and the unit of work shared among threads
+    constexpr static size_t group_size = 64;
+
+    size_t count;
+    // registers[reg * count + instance], stack[level * count + instance]
+    std::vector<uint8_t> registers;
+    std::vector<uint16_t> stack;
+    std::vector<uint16_t> sp;
+    std::vector<uint16_t> pc;
+    std::vector<uint16_t> address_reg;
+    std::vector<uint8_t> delay_timer;
+    std::vector<uint8_t> sound_timer;
+    // Bit N set while key N is held
+    std::vector<uint16_t> keys;
+    std::vector<BatchStatus> status;
+    std::vector<uint8_t> keypress_store_reg;
+    std::vector<uint8_t> hi_res;
+    std::vector<uint64_t> random_state;
+    // memory[instance * mem_size + address]
+    std::vector<uint8_t> memory;
+    // Each instance's display[screen_h][display_row_words], in order
+    std::vector<uint64_t> display;
+    bool legacy_shift = false;
+    bool legacy_memops = false;
+    // Shared by all instances; host time isn't used
+    ClockState clock;
+
+    // Run instances begin to end for cycle_count cycles, from the current clock
+    void run_group(size_t begin, size_t end, uint64_t cycle_count);
+    void step_group(size_t begin, size_t end);
+    // Run an opcode on every instance from begin to end at once. Returns
+    // false if it's one that has to run an instance at a time
+    bool step_uniform(size_t begin, size_t end, uint16_t opcode);
+    void step_instance(size_t instance, uint16_t opcode);
+    void cycle_timers(size_t begin, size_t end);
+    uint16_t fetch_opcode(size_t instance, uint16_t address);
+    uint8_t* registers_of(int reg);
+    uint64_t* display_of(size_t instance);
+    void draw_sprite(size_t instance, int x, int y, int n);
+};
+
+#endif
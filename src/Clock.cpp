@@ -1,27 +1,69 @@
 #include "Clock.h"
 #include <cstdint>
+#include <algorithm>
 #include "Chip8.h"
 
-constexpr uint64_t default_cycle_rate = 1000;
-constexpr uint64_t max_cycles_per_frame = 20000;
+constexpr uint64_t ns_per_second = 1000000000;
 
 Clock::Clock(Chip8* target_vm) {
-    cycle_timer = 0;
-    set_cycle_rate(default_cycle_rate);
+    cycle_rate = default_cycle_rate;
+    time_remainder = 0;
+    timer_phase = 0;
+    cycle_count = 0;
     vm = target_vm;
 }
 
 void Clock::set_cycle_rate(uint64_t new_cycle_rate) {
-    cycle_time = 1e9 / new_cycle_rate;
-    max_cycle_accum = cycle_time * max_cycles_per_frame;
+    // The rate is a divisor here and in run
+    new_cycle_rate = std::max<uint64_t>(new_cycle_rate, 1);
+    // Keep the same progress towards the next timer decrement
+    timer_phase = timer_phase * new_cycle_rate / cycle_rate;
+    time_remainder = 0;
+    cycle_rate = new_cycle_rate;
 }
 
-void Clock::tick(uint64_t delta_time) {
-    cycle_timer += delta_time;
-    if (cycle_timer > max_cycle_accum)
-        cycle_timer = max_cycle_accum;
-    while (cycle_timer >= cycle_time) {
-        vm->cycle_vm();
-        cycle_timer -= cycle_time;
+uint64_t Clock::get_cycle_rate() {
+    return cycle_rate;
+}
+
+uint64_t Clock::tick(uint64_t delta_time, uint64_t max_delta_time) {
+    // The second bound just avoids overflow
+    delta_time = std::min({ delta_time, max_delta_time, ns_per_second });
+    time_remainder += delta_time * cycle_rate;
+    uint64_t cycles_run = time_remainder / ns_per_second;
+    time_remainder %= ns_per_second;
+    run(cycles_run);
+    return cycles_run;
+}
+
+void Clock::run(uint64_t cycle_count) {
+    while (cycle_count > 0) {
+        // Run up to the next timer decrement
+        uint64_t cycles_run = std::min(cycle_count, get_cycles_to_timer());
+        vm->run_cycles(cycles_run);
+        this->cycle_count += cycles_run;
+        cycle_count -= cycles_run;
+
+        timer_phase += cycles_run * timer_rate;
+        while (timer_phase >= cycle_rate) {
+            timer_phase -= cycle_rate;
+            vm->cycle_timers();
+        }
     }
 }
+
+uint64_t Clock::get_cycle_count() {
+    return cycle_count;
+}
+
+uint64_t Clock::get_cycles_to_timer() {
+    return (cycle_rate - timer_phase + timer_rate - 1) / timer_rate;
+}
+
+const ClockState& Clock::get_state() {
+    return *this;
+}
+
+void Clock::set_state(const ClockState& state) {
+    ClockState::operator=(state);
+}
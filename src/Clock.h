@@ -5,17 +5,41 @@
 
 class Chip8;
 
-// Time units in nanoseconds
+constexpr uint64_t default_cycle_rate = 1000;
+// Delay and sound timer decrements per second
+constexpr uint64_t timer_rate = 60;
 
-class Clock {
+// Emulated time is counted in VM cycles. Host time is converted exactly, and
+// the 60 Hz timers tick at fixed points of the emulated timeline, so a run is
+// fully determined by the number of cycles it's given.
+
+struct ClockState {
+    uint64_t cycle_rate;
+    // Host time not yet run, in units of 1/(1e9 * cycle_rate) seconds
+    uint64_t time_remainder;
+    // Progress towards the next timer decrement; 60 per cycle, which fires at cycle_rate
+    uint64_t timer_phase;
+    uint64_t cycle_count;
+};
+
+class Clock : private ClockState {
 public:
     Clock(Chip8* target_vm);
     void set_cycle_rate(uint64_t new_cycle_rate);
-    void tick(uint64_t delta_time);
+    uint64_t get_cycle_rate();
+    // Run the VM for delta_time of host time, dropping anything past
+    // max_delta_time (a stall shouldn't be caught up on). Returns the number of VM cycles run
+    uint64_t tick(uint64_t delta_time, uint64_t max_delta_time);
+    // Run the VM for exactly cycle_count cycles of emulated time
+    void run(uint64_t cycle_count);
+    // Cycles of emulated time since the VM started
+    uint64_t get_cycle_count();
+    // Cycles from get_cycle_count to the next timer decrement. During a run,
+    // that's from the start of the part of it the VM is running
+    uint64_t get_cycles_to_timer();
+    const ClockState& get_state();
+    void set_state(const ClockState& state);
 private:
-    uint64_t cycle_timer;
-    uint64_t cycle_time;
-    uint64_t max_cycle_accum;
     Chip8* vm;
 };
 
@@ -1,10 +1,15 @@
 #include "Config.h"
 #include "Platform.h"
+#include "RomDatabase.h"
 #include <iostream>
 #include <stdexcept>
 #include <algorithm>
 
+constexpr uint64_t min_cycle_rate = 1;
+constexpr uint64_t max_cycle_rate = 1000000;
 constexpr int max_sound_buffer = 65536;
+constexpr int max_rewind_seconds = 3600;
+constexpr int max_rewind_buffer = 1024 * 1024;
 
 // Strings for storing timing mode in config
 const std::string timing_mode_strings[] = {
@@ -12,11 +17,21 @@ const std::string timing_mode_strings[] = {
     "cosmac",
 };
 
+// Strings for storing frame pacing in config
+const std::string frame_pacing_strings[] = {
+    "off",
+    "timer",
+    "vsync",
+};
+
 ConfigStatus config_status;
 
 uint64_t config_cycle_rate = 500;
 bool sound_enabled = true;
-int sound_buffer_size = 1024;
+int sound_buffer_size = 256;
+FramePacing frame_pacing = PACING_TIMER;
+int rewind_seconds = 60;
+int rewind_buffer_size = 1024;
 
 std::shared_ptr<std::fstream> load_config(bool write_mode) {
     std::shared_ptr<std::fstream> config = std::make_shared<std::fstream>();
@@ -53,7 +68,7 @@ void parse_config(std::shared_ptr<std::fstream> config, Chip8* vm) {
             
             if (key == "cycles") {
                 try {
-                    config_cycle_rate = std::min(std::stoul(value), 1000000UL);
+                    config_cycle_rate = std::clamp<uint64_t>(std::stoul(value), min_cycle_rate, max_cycle_rate);
                 } catch (...) {}
             }
             else if (key == "sound" && value == "false") {
@@ -73,6 +88,22 @@ void parse_config(std::shared_ptr<std::fstream> config, Chip8* vm) {
             else if (key == "timing" && value == timing_mode_strings[TIMING_FIXED]) {
                 vm->set_timing_mode(TIMING_FIXED);
             }
+            else if (key == "rewind_seconds") {
+                try {
+                    rewind_seconds = std::max(0, std::min(std::stoi(value), max_rewind_seconds));
+                } catch (...) {}
+            }
+            else if (key == "rewind_buffer") {
+                try {
+                    rewind_buffer_size = std::max(0, std::min(std::stoi(value), max_rewind_buffer));
+                } catch (...) {}
+            }
+            else if (key == "frame_pacing") {
+                if (value == frame_pacing_strings[PACING_OFF])
+                    frame_pacing = PACING_OFF;
+                else if (value == frame_pacing_strings[PACING_VSYNC])
+                    frame_pacing = PACING_VSYNC;
+            }
         }
     }
     vm->set_cycle_rate(config_cycle_rate);
@@ -97,6 +128,9 @@ void write_config(Chip8* vm) {
     write_config_line(config, "legacy_memops", bool_to_str(vm->get_legacy_memops()));
     write_config_line(config, "legacy_shift", bool_to_str(vm->get_legacy_shift()));
     write_config_line(config, "timing", timing_mode_strings[vm->get_timing_mode()]);
+    write_config_line(config, "frame_pacing", frame_pacing_strings[frame_pacing]);
+    write_config_line(config, "rewind_seconds", std::to_string(rewind_seconds));
+    write_config_line(config, "rewind_buffer", std::to_string(rewind_buffer_size));
 }
 
 void load_config_into_vm(Chip8* vm) {
@@ -113,3 +147,24 @@ void load_config_into_vm(Chip8* vm) {
     if (config_status != CONFIG_ERROR)
         write_config(vm);
 }
+
+bool load_rom_profile(const uint8_t* rom, size_t rom_size, Chip8* vm) {
+    RomDatabase database;
+    try {
+        if (!database.open(get_rom_database_path()))
+            return false;
+    }
+    catch (std::runtime_error&) {
+        return false;
+    }
+    RomProfile profile;
+    if (!database.find(hash_rom(rom, rom_size), profile))
+        return false;
+    vm->set_timing_mode(profile.timing_mode == TIMING_COSMAC ? TIMING_COSMAC : TIMING_FIXED);
+    vm->set_legacy_shift(profile.flags & ROM_LEGACY_SHIFT);
+    vm->set_legacy_memops(profile.flags & ROM_LEGACY_MEMOPS);
+    if (profile.cycle_rate > 0)
+        config_cycle_rate = std::clamp<uint64_t>(profile.cycle_rate, min_cycle_rate, max_cycle_rate);
+    vm->set_cycle_rate(config_cycle_rate);
+    return true;
+}
@@ -13,15 +13,33 @@ enum ConfigStatus {
     CONFIG_ERROR,
 };
 
+// How the emulation thread paces itself
+enum FramePacing {
+    // Emulate as often as possible, sleeping a bit in between
+    PACING_OFF,
+    // Emulate once per display refresh, waiting on a high resolution timer
+    PACING_TIMER,
+    // Like PACING_TIMER, with presentation synchronized to vertical blank
+    PACING_VSYNC,
+};
+
 extern ConfigStatus config_status;
 extern uint64_t config_cycle_rate;
 extern bool sound_enabled;
 extern int sound_buffer_size;
+extern FramePacing frame_pacing;
+// How far back rewinding goes, 0 to disable
+extern int rewind_seconds;
+// Memory for rewind history, in KiB
+extern int rewind_buffer_size;
 
 std::shared_ptr<std::fstream> load_config(bool write_mode);
 void parse_config(std::shared_ptr<std::fstream> config, Chip8* vm);
 void write_config_line(std::shared_ptr<std::fstream> config, std::string key, std::string value);
 void write_config(Chip8* vm);
 void load_config_into_vm(Chip8* vm);
+// Override the config with the ROM's settings from the ROM database, if
+// it's listed. Returns whether it was
+bool load_rom_profile(const uint8_t* rom, size_t rom_size, Chip8* vm);
 
 #endif
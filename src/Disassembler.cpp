@@ -0,0 +1,56 @@
+#include "Disassembler.h"
+#include <cstdio>
+#include "Chip8.h"
+
+std::string disassemble(uint16_t opcode) {
+    int x = (opcode & 0x0F00) >> 8;
+    int y = (opcode & 0x00F0) >> 4;
+    int n = opcode & 0x000F;
+    int nn = opcode & 0x00FF;
+    int nnn = opcode & 0x0FFF;
+    char text[32];
+    switch (Chip8::decode_opcode_id(opcode)) {
+        case OPCODE_00CN: std::snprintf(text, sizeof(text), "SCD %d", n); break;
+        case OPCODE_00E0: return "CLS";
+        case OPCODE_00EE: return "RET";
+        case OPCODE_00FB: return "SCR";
+        case OPCODE_00FC: return "SCL";
+        case OPCODE_00FD: return "EXIT";
+        case OPCODE_00FE: return "LOW";
+        case OPCODE_00FF: return "HIGH";
+        case OPCODE_1NNN: std::snprintf(text, sizeof(text), "JP 0x%03X", nnn); break;
+        case OPCODE_2NNN: std::snprintf(text, sizeof(text), "CALL 0x%03X", nnn); break;
+        case OPCODE_3XNN: std::snprintf(text, sizeof(text), "SE V%X, 0x%02X", x, nn); break;
+        case OPCODE_4XNN: std::snprintf(text, sizeof(text), "SNE V%X, 0x%02X", x, nn); break;
+        case OPCODE_5XY0: std::snprintf(text, sizeof(text), "SE V%X, V%X", x, y); break;
+        case OPCODE_6XNN: std::snprintf(text, sizeof(text), "LD V%X, 0x%02X", x, nn); break;
+        case OPCODE_7XNN: std::snprintf(text, sizeof(text), "ADD V%X, 0x%02X", x, nn); break;
+        case OPCODE_8XY0: std::snprintf(text, sizeof(text), "LD V%X, V%X", x, y); break;
+        case OPCODE_8XY1: std::snprintf(text, sizeof(text), "OR V%X, V%X", x, y); break;
+        case OPCODE_8XY2: std::snprintf(text, sizeof(text), "AND V%X, V%X", x, y); break;
+        case OPCODE_8XY3: std::snprintf(text, sizeof(text), "XOR V%X, V%X", x, y); break;
+        case OPCODE_8XY4: std::snprintf(text, sizeof(text), "ADD V%X, V%X", x, y); break;
+        case OPCODE_8XY5: std::snprintf(text, sizeof(text), "SUB V%X, V%X", x, y); break;
+        case OPCODE_8XY6: std::snprintf(text, sizeof(text), "SHR V%X, V%X", x, y); break;
+        case OPCODE_8XY7: std::snprintf(text, sizeof(text), "SUBN V%X, V%X", x, y); break;
+        case OPCODE_8XYE: std::snprintf(text, sizeof(text), "SHL V%X, V%X", x, y); break;
+        case OPCODE_9XY0: std::snprintf(text, sizeof(text), "SNE V%X, V%X", x, y); break;
+        case OPCODE_ANNN: std::snprintf(text, sizeof(text), "LD I, 0x%03X", nnn); break;
+        case OPCODE_BNNN: std::snprintf(text, sizeof(text), "JP V0, 0x%03X", nnn); break;
+        case OPCODE_CXNN: std::snprintf(text, sizeof(text), "RND V%X, 0x%02X", x, nn); break;
+        case OPCODE_DXYN: std::snprintf(text, sizeof(text), "DRW V%X, V%X, %d", x, y, n); break;
+        case OPCODE_EX9E: std::snprintf(text, sizeof(text), "SKP V%X", x); break;
+        case OPCODE_EXA1: std::snprintf(text, sizeof(text), "SKNP V%X", x); break;
+        case OPCODE_FX07: std::snprintf(text, sizeof(text), "LD V%X, DT", x); break;
+        case OPCODE_FX0A: std::snprintf(text, sizeof(text), "LD V%X, K", x); break;
+        case OPCODE_FX15: std::snprintf(text, sizeof(text), "LD DT, V%X", x); break;
+        case OPCODE_FX18: std::snprintf(text, sizeof(text), "LD ST, V%X", x); break;
+        case OPCODE_FX1E: std::snprintf(text, sizeof(text), "ADD I, V%X", x); break;
+        case OPCODE_FX29: std::snprintf(text, sizeof(text), "LD F, V%X", x); break;
+        case OPCODE_FX33: std::snprintf(text, sizeof(text), "LD B, V%X", x); break;
+        case OPCODE_FX55: std::snprintf(text, sizeof(text), "LD [I], V%X", x); break;
+        case OPCODE_FX65: std::snprintf(text, sizeof(text), "LD V%X, [I]", x); break;
+        default: std::snprintf(text, sizeof(text), "DW 0x%04X", opcode); break;
+    }
+    return text;
+}
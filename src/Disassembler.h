@@ -0,0 +1,12 @@
+// Opcode mnemonics for listings
+#ifndef DISASSEMBLER_H
+#define DISASSEMBLER_H
+
+#include <cstdint>
+#include <string>
+
+// Text for the opcode, e.g. "LD VA, 0x05". Opcodes the interpreter ignores
+// are shown as data words
+std::string disassemble(uint16_t opcode);
+
+#endif
@@ -0,0 +1,38 @@
+#include "Display.h"
+#include "Chip8.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DISPLAY_SSE2
+#endif
+
+#ifdef DISPLAY_SSE2
+void expand_display_row(const uint64_t* row, uint32_t* pixels, uint32_t on_color, uint32_t off_color) {
+    // Each byte of pixels becomes 8 colors, 4 per vector: broadcast the byte, and
+    // select on/off per lane by testing one bit in each
+    const __m128i high_bits = _mm_set_epi32(0x10, 0x20, 0x40, 0x80);
+    const __m128i low_bits = _mm_set_epi32(0x1, 0x2, 0x4, 0x8);
+    const __m128i on = _mm_set1_epi32(on_color);
+    const __m128i off = _mm_set1_epi32(off_color);
+    __m128i* out = (__m128i*)pixels;
+    for (int word = 0; word < display_row_words; word++) {
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            __m128i byte = _mm_set1_epi32((int)((row[word] >> shift) & 0xFF));
+            __m128i high_mask = _mm_cmpeq_epi32(_mm_and_si128(byte, high_bits), high_bits);
+            __m128i low_mask = _mm_cmpeq_epi32(_mm_and_si128(byte, low_bits), low_bits);
+            _mm_storeu_si128(out++, _mm_or_si128(_mm_and_si128(high_mask, on), _mm_andnot_si128(high_mask, off)));
+            _mm_storeu_si128(out++, _mm_or_si128(_mm_and_si128(low_mask, on), _mm_andnot_si128(low_mask, off)));
+        }
+    }
+}
+#else
+void expand_display_row(const uint64_t* row, uint32_t* pixels, uint32_t on_color, uint32_t off_color) {
+    uint32_t flip = on_color ^ off_color;
+    for (int word = 0; word < display_row_words; word++) {
+        for (int bit = 63; bit >= 0; bit--) {
+            uint32_t mask = 0u - (uint32_t)((row[word] >> bit) & 1);
+            *pixels++ = off_color ^ (flip & mask);
+        }
+    }
+}
+#endif
@@ -0,0 +1,51 @@
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include <cstdint>
+#include "Chip8.h"
+
+// Sprite bytes with every bit doubled, for drawing 2x2 pixels in lo-res
+struct LoresDoubledBits {
+    uint16_t table[256];
+
+    constexpr LoresDoubledBits() : table() {
+        for (int byte = 0; byte < 256; byte++) {
+            for (int bit = 0; bit < 8; bit++) {
+                if (byte & (1 << bit))
+                    table[byte] |= 3 << (bit * 2);
+            }
+        }
+    }
+
+    constexpr uint16_t operator[](int byte) const { return table[byte]; }
+};
+constexpr LoresDoubledBits lores_doubled_bits;
+
+// XOR a sprite row of up to 64 bits onto a packed display row, starting at x
+// and wrapping around horizontally. Returns whether any pixel was turned off
+inline bool xor_sprite_row(uint64_t* row, uint64_t bits, int width, int x) {
+    // Align the sprite to the leftmost pixel, then rotate it into place
+    uint64_t left = bits << (64 - width);
+    uint64_t right = 0;
+    if (x >= 64) {
+        right = left;
+        left = 0;
+        x -= 64;
+    }
+    if (x > 0) {
+        uint64_t shifted_out = right << (64 - x);
+        right = (right >> x) | (left << (64 - x));
+        left = (left >> x) | shifted_out;
+    }
+
+    bool collided = ((row[0] & left) | (row[1] & right)) != 0;
+    row[0] ^= left;
+    row[1] ^= right;
+    return collided;
+}
+
+// Expand a packed display row (see Chip8::get_display_row) into one 32-bit
+// color per pixel
+void expand_display_row(const uint64_t* row, uint32_t* pixels, uint32_t on_color, uint32_t off_color);
+
+#endif
@@ -0,0 +1,116 @@
+#include "InputLog.h"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+// File layout: key=value settings, then an "events" line followed by one
+// "<cycle> <key> <down|up>" line per event.
+
+void InputLog::start_recording(Chip8* vm, uint64_t seed) {
+    this->seed = seed;
+    vm->seed_random(seed);
+    timing_mode = vm->get_timing_mode();
+    cycle_rate = vm->get_cycle_rate();
+    legacy_shift = vm->get_legacy_shift();
+    legacy_memops = vm->get_legacy_memops();
+    end_cycle = vm->get_cycle_count();
+    events.clear();
+}
+
+void InputLog::record_event(Chip8* vm, uint8_t key, bool pressed) {
+    events.push_back({ vm->get_cycle_count(), key, pressed });
+}
+
+void InputLog::stop_recording(Chip8* vm) {
+    end_cycle = vm->get_cycle_count();
+}
+
+bool InputLog::save(const std::string& file_name) {
+    std::ofstream log_file(file_name, std::ios::out | std::ios::trunc);
+    if (!log_file)
+        return false;
+    log_file << "seed=" << seed << "\n"
+        << "timing=" << (timing_mode == TIMING_FIXED ? "fixed" : "cosmac") << "\n"
+        << "cycles=" << cycle_rate << "\n"
+        << "legacy_shift=" << (legacy_shift ? "true" : "false") << "\n"
+        << "legacy_memops=" << (legacy_memops ? "true" : "false") << "\n"
+        << "end=" << end_cycle << "\n"
+        << "events\n";
+    for (const InputEvent& event : events)
+        log_file << event.cycle << " " << (int)event.key << " " << (event.pressed ? "down" : "up") << "\n";
+    return !log_file.fail();
+}
+
+bool InputLog::load(const std::string& file_name) {
+    std::ifstream log_file(file_name);
+    if (!log_file)
+        return false;
+    events.clear();
+    cycle_rate = 0;
+    std::string line;
+    try {
+        while (std::getline(log_file, line) && line != "events") {
+            size_t eq_pos = line.find('=');
+            if (eq_pos == std::string::npos)
+                return false;
+            std::string key = line.substr(0, eq_pos);
+            std::string value = line.substr(eq_pos + 1);
+            if (key == "seed")
+                seed = std::stoull(value);
+            else if (key == "timing")
+                timing_mode = value == "fixed" ? TIMING_FIXED : TIMING_COSMAC;
+            else if (key == "cycles")
+                cycle_rate = std::stoull(value);
+            else if (key == "legacy_shift")
+                legacy_shift = value == "true";
+            else if (key == "legacy_memops")
+                legacy_memops = value == "true";
+            else if (key == "end")
+                end_cycle = std::stoull(value);
+        }
+        // Replay can't be timed without the rate the log was recorded at
+        if (cycle_rate == 0)
+            return false;
+        uint64_t last_cycle = 0;
+        while (std::getline(log_file, line)) {
+            std::istringstream fields(line);
+            uint64_t cycle;
+            int key;
+            std::string state;
+            if (!(fields >> cycle >> key >> state) || key < 0 || key >= key_count || cycle < last_cycle)
+                return false;
+            events.push_back({ cycle, (uint8_t)key, state == "down" });
+            last_cycle = cycle;
+        }
+    }
+    catch (std::logic_error&) {
+        return false;
+    }
+    return true;
+}
+
+void InputLog::apply_settings(Chip8* vm) {
+    vm->set_timing_mode(timing_mode);
+    vm->set_cycle_rate(cycle_rate);
+    vm->set_legacy_shift(legacy_shift);
+    vm->set_legacy_memops(legacy_memops);
+    vm->seed_random(seed);
+}
+
+void InputLog::replay(Chip8* vm) {
+    for (const InputEvent& event : events) {
+        if (event.cycle > end_cycle)
+            break;
+        vm->run_for(event.cycle - vm->get_cycle_count());
+        if (event.pressed)
+            vm->on_keypress(event.key);
+        else
+            vm->on_keyrelease(event.key);
+    }
+    if (end_cycle > vm->get_cycle_count())
+        vm->run_for(end_cycle - vm->get_cycle_count());
+}
+
+uint64_t InputLog::get_end_cycle() {
+    return end_cycle;
+}
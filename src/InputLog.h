@@ -0,0 +1,43 @@
+// Recording and replay of keypad input, stamped with emulated cycles
+#ifndef INPUTLOG_H
+#define INPUTLOG_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Chip8.h"
+
+struct InputEvent {
+    // Clock cycle count when the event was delivered
+    uint64_t cycle;
+    uint8_t key;
+    bool pressed;
+};
+
+// A run is reproduced exactly by starting a fresh VM with the same ROM and
+// settings, and delivering each event at the cycle it was recorded at.
+class InputLog {
+public:
+    // Seed the VM and capture its settings. The VM should have just loaded its ROM
+    void start_recording(Chip8* vm, uint64_t seed);
+    void record_event(Chip8* vm, uint8_t key, bool pressed);
+    // Mark the end of the run at the VM's current cycle
+    void stop_recording(Chip8* vm);
+    bool save(const std::string& file_name);
+    bool load(const std::string& file_name);
+    // Configure a fresh VM like the recorded one
+    void apply_settings(Chip8* vm);
+    // Run the VM to the end of the log, delivering the recorded events
+    void replay(Chip8* vm);
+    uint64_t get_end_cycle();
+private:
+    uint64_t seed = 0;
+    TimingMode timing_mode = TIMING_COSMAC;
+    uint64_t cycle_rate = 0;
+    bool legacy_shift = false;
+    bool legacy_memops = false;
+    uint64_t end_cycle = 0;
+    std::vector<InputEvent> events;
+};
+
+#endif
@@ -0,0 +1,56 @@
+#include "Observation.h"
+#include <new>
+
+bool ObservationExport::open(const std::string& file_name) {
+    close();
+    if (!shared_memory.open(file_name, sizeof(ObservationRegion)))
+        return false;
+    // Nothing is published until the header is complete
+    std::memset(shared_memory.data(), 0, sizeof(ObservationRegion));
+    region = new (shared_memory.data()) ObservationRegion;
+    region->version = observation_version;
+    region->size = sizeof(ObservationRegion);
+    region->sequence.store(0, std::memory_order_relaxed);
+    region->keys.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    region->magic = observation_magic;
+    frame = 0;
+    return true;
+}
+
+void ObservationExport::close() {
+    region = NULL;
+    shared_memory.close();
+}
+
+bool ObservationExport::is_open() {
+    return region != NULL;
+}
+
+void ObservationExport::publish(Chip8* vm) {
+    const Chip8State& state = vm->get_state();
+    Observation& observation = region->observation;
+    uint64_t sequence = region->sequence.load(std::memory_order_relaxed);
+    region->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    observation.frame = ++frame;
+    observation.cycle_count = vm->get_cycle_count();
+    observation.instruction_count = vm->get_instruction_count();
+    observation.pc = state.pc;
+    observation.address_reg = state.address_reg;
+    observation.sp = state.sp;
+    std::memcpy(observation.stack, state.stack, sizeof(observation.stack));
+    std::memcpy(observation.registers, state.registers, sizeof(observation.registers));
+    observation.delay_timer = state.delay_timer;
+    observation.sound_timer = state.sound_timer;
+    observation.hi_res = state.hi_res;
+    observation.exited = state.exit_opcode_called;
+    std::memcpy(observation.display, state.display, sizeof(observation.display));
+
+    region->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+uint16_t ObservationExport::get_keys() {
+    return region->keys.load(std::memory_order_relaxed) & ((1 << key_count) - 1);
+}
@@ -0,0 +1,83 @@
+// VM state published through shared memory, for controllers in other processes
+#ifndef OBSERVATION_H
+#define OBSERVATION_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <atomic>
+#include "Chip8.h"
+#include "Platform.h"
+
+constexpr uint32_t observation_magic = 0x5653424F; // "OBSV"
+// Bump when Observation or ObservationRegion change
+constexpr uint32_t observation_version = 1;
+
+// Snapshot of what a player could see, plus the registers
+struct Observation {
+    // Published frames so far, starting at 1
+    uint64_t frame;
+    uint64_t cycle_count;
+    uint64_t instruction_count;
+    uint16_t pc;
+    uint16_t address_reg;
+    uint16_t sp;
+    uint16_t stack[stack_depth];
+    uint8_t registers[reg_count];
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t hi_res;
+    uint8_t exited;
+    // Packed rows like Chip8::get_display_row, bit 63 of the first word is the leftmost pixel
+    uint64_t display[screen_h][display_row_words];
+};
+
+// Layout of the shared file. The interpreter writes the header and the
+// observation; the controller writes keys
+struct ObservationRegion {
+    uint32_t magic;
+    uint32_t version;
+    // sizeof(ObservationRegion)
+    uint32_t size;
+    uint32_t reserved;
+    // Seqlock: odd while the observation is being written
+    std::atomic<uint64_t> sequence;
+    Observation observation;
+    // Bit N set while the controller holds key N. On its own cache line,
+    // so the controller's writes don't slow down the interpreter's
+    alignas(64) std::atomic<uint32_t> keys;
+};
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+    "Atomics shared between processes must be lock-free");
+
+// Interpreter side. Publishing is plain memory writes, no system calls
+class ObservationExport {
+public:
+    // Create or reset the shared file and map it
+    bool open(const std::string& file_name);
+    void close();
+    bool is_open();
+    void publish(Chip8* vm);
+    // Keys the controller holds, bit N for key N
+    uint16_t get_keys();
+private:
+    SharedMemory shared_memory;
+    ObservationRegion* region = NULL;
+    uint64_t frame = 0;
+};
+
+// Controller side. Copy out the latest observation, retrying while it's
+// being written, and return its frame number
+inline uint64_t read_observation(const ObservationRegion* region, Observation& observation) {
+    while (true) {
+        uint64_t sequence = region->sequence.load(std::memory_order_acquire);
+        if (sequence & 1)
+            continue;
+        std::memcpy(&observation, (const void*)&region->observation, sizeof(observation));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (region->sequence.load(std::memory_order_relaxed) == sequence)
+            return observation.frame;
+    }
+}
+
+#endif
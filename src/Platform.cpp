@@ -1,17 +1,26 @@
 // OS-specific code
 #include "Platform.h"
 #include <stdexcept>
+#include <cerrno>
 
 #ifdef _WIN32
 #include <windows.h>
 #include <shlwapi.h>
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
 #else
 #include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <linux/limits.h>
 #endif
 
 constexpr char const* config_folder_name = "Chimp8";
 constexpr char const* config_name = "Chimp8.ini";
+constexpr char const* rom_database_name = "Chimp8.romdb";
 
 constexpr int idle_sleep = 1000;
 constexpr int win_idle_sleep = 1;
@@ -61,6 +70,11 @@ std::string get_config_path() {
 #endif
 }
 
+std::string get_rom_database_path() {
+    std::string config_path = get_config_path();
+    return config_path.substr(0, config_path.find_last_of("/\\") + 1) + rom_database_name;
+}
+
 void main_sleep() {
     #ifdef _WIN32
     Sleep(win_idle_sleep);
@@ -68,3 +82,172 @@ void main_sleep() {
     usleep(idle_sleep);
     #endif
 }
+
+void precise_sleep(uint64_t duration_ns) {
+    #ifdef _WIN32
+    // Sleep() only wakes on the ~15.6 ms system tick. High resolution timers
+    // need Windows 10 1803, older versions get a normal timer at tick resolution
+    static thread_local HANDLE timer = NULL;
+    if (!timer)
+        timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (!timer)
+        timer = CreateWaitableTimerW(NULL, TRUE, NULL);
+    LARGE_INTEGER due_time;
+    // Negative means relative, in 100 ns units
+    due_time.QuadPart = -(LONGLONG)(duration_ns / 100);
+    if (timer && SetWaitableTimer(timer, &due_time, 0, NULL, NULL, FALSE))
+        WaitForSingleObject(timer, INFINITE);
+    else
+        Sleep((DWORD)(duration_ns / 1000000));
+    #else
+    struct timespec duration;
+    duration.tv_sec = duration_ns / 1000000000;
+    duration.tv_nsec = duration_ns % 1000000000;
+    while (nanosleep(&duration, &duration) == -1 && errno == EINTR);
+    #endif
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string& file_name) {
+    close();
+    #ifdef _WIN32
+    file_handle = CreateFileA(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file_handle == INVALID_HANDLE_VALUE) {
+        file_handle = NULL;
+        return false;
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0) {
+        close();
+        return false;
+    }
+    mapping_handle = CreateFileMappingA(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping_handle == NULL) {
+        close();
+        return false;
+    }
+    view = (const uint8_t*)MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+    if (view == NULL) {
+        close();
+        return false;
+    }
+    view_size = (size_t)file_size.QuadPart;
+    #else
+    int fd = ::open(file_name.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+    struct stat file_stat;
+    // mmap can't map an empty file
+    if (fstat(fd, &file_stat) == -1 || file_stat.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+    void* mapping = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after the descriptor is closed
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+    view = (const uint8_t*)mapping;
+    view_size = file_stat.st_size;
+    #endif
+    return true;
+}
+
+void MappedFile::close() {
+    #ifdef _WIN32
+    if (view)
+        UnmapViewOfFile(view);
+    if (mapping_handle)
+        CloseHandle(mapping_handle);
+    if (file_handle)
+        CloseHandle(file_handle);
+    mapping_handle = NULL;
+    file_handle = NULL;
+    #else
+    if (view)
+        munmap((void*)view, view_size);
+    #endif
+    view = NULL;
+    view_size = 0;
+}
+
+const uint8_t* MappedFile::data() {
+    return view;
+}
+
+size_t MappedFile::size() {
+    return view_size;
+}
+
+SharedMemory::~SharedMemory() {
+    close();
+}
+
+bool SharedMemory::open(const std::string& file_name, size_t map_size) {
+    close();
+    #ifdef _WIN32
+    file_handle = CreateFileA(file_name.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file_handle == INVALID_HANDLE_VALUE) {
+        file_handle = NULL;
+        return false;
+    }
+    // The mapping extends the file to map_size
+    mapping_handle = CreateFileMappingA(file_handle, NULL, PAGE_READWRITE, (DWORD)((uint64_t)map_size >> 32),
+        (DWORD)map_size, NULL);
+    if (mapping_handle == NULL) {
+        close();
+        return false;
+    }
+    view = (uint8_t*)MapViewOfFile(mapping_handle, FILE_MAP_ALL_ACCESS, 0, 0, map_size);
+    if (view == NULL) {
+        close();
+        return false;
+    }
+    #else
+    int fd = ::open(file_name.c_str(), O_RDWR | O_CREAT, 0600);
+    if (fd == -1)
+        return false;
+    if (ftruncate(fd, map_size) == -1) {
+        ::close(fd);
+        return false;
+    }
+    void* mapping = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+    view = (uint8_t*)mapping;
+    #endif
+    view_size = map_size;
+    return true;
+}
+
+void SharedMemory::close() {
+    #ifdef _WIN32
+    if (view)
+        UnmapViewOfFile(view);
+    if (mapping_handle)
+        CloseHandle(mapping_handle);
+    if (file_handle)
+        CloseHandle(file_handle);
+    mapping_handle = NULL;
+    file_handle = NULL;
+    #else
+    if (view)
+        munmap(view, view_size);
+    #endif
+    view = NULL;
+    view_size = 0;
+}
+
+uint8_t* SharedMemory::data() {
+    return view;
+}
+
+size_t SharedMemory::size() {
+    return view_size;
+}
@@ -2,10 +2,57 @@
 #ifndef CHIMP8OS_H
 #define CHIMP8OS_H
 
+#include <cstdint>
 #include <string>
+#include <cstddef>
 
 std::string get_program_path();
 std::string get_config_path();
+// Per-ROM settings database, next to the config file
+std::string get_rom_database_path();
 void main_sleep();
+// Sleep with the best resolution the OS offers
+void precise_sleep(uint64_t duration_ns);
+
+// Read-only view of a whole file, mapped into memory
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+    bool open(const std::string& file_name);
+    void close();
+    const uint8_t* data();
+    size_t size();
+private:
+    const uint8_t* view = NULL;
+    size_t view_size = 0;
+#ifdef _WIN32
+    void* file_handle = NULL;
+    void* mapping_handle = NULL;
+#endif
+};
+
+// Writable view of a file, shared with any other process that maps it
+class SharedMemory {
+public:
+    SharedMemory() = default;
+    SharedMemory(const SharedMemory&) = delete;
+    SharedMemory& operator=(const SharedMemory&) = delete;
+    ~SharedMemory();
+    // Create the file if needed, and resize it to map_size bytes
+    bool open(const std::string& file_name, size_t map_size);
+    void close();
+    uint8_t* data();
+    size_t size();
+private:
+    uint8_t* view = NULL;
+    size_t view_size = 0;
+#ifdef _WIN32
+    void* file_handle = NULL;
+    void* mapping_handle = NULL;
+#endif
+};
 
 #endif
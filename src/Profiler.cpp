@@ -0,0 +1,75 @@
+#include "Profiler.h"
+#include <fstream>
+#include <iomanip>
+
+const char* const opcode_names[OPCODE_COUNT] = {
+    "NOP",
+    "00CN", "00E0", "00EE", "00FB",
+    "00FC", "00FD", "00FE", "00FF",
+    "1NNN", "2NNN", "3XNN", "4XNN",
+    "5XY0", "6XNN", "7XNN",
+    "8XY0", "8XY1", "8XY2", "8XY3",
+    "8XY4", "8XY5", "8XY6", "8XY7",
+    "8XYE", "9XY0", "ANNN", "BNNN",
+    "CXNN", "DXYN", "EX9E", "EXA1",
+    "FX07", "FX0A", "FX15", "FX18",
+    "FX1E", "FX29", "FX33", "FX55",
+    "FX65",
+};
+
+bool Profiler::write(const std::string& file_name) {
+    std::ofstream file(file_name, std::ios::out | std::ios::trunc);
+    if (!file)
+        return false;
+    std::string extension = ".csv";
+    if (file_name.size() >= extension.size()
+        && file_name.compare(file_name.size() - extension.size(), extension.size(), extension) == 0)
+        write_csv(file);
+    else
+        write_json(file);
+    return !file.fail();
+}
+
+void Profiler::write_json(std::ostream& out) {
+    out << "{\n  \"opcodes\": [";
+    bool first = true;
+    for (int i = 0; i < OPCODE_COUNT; i++) {
+        if (opcode_counts[i] == 0)
+            continue;
+        out << (first ? "\n" : ",\n") << "    {\"opcode\": \"" << opcode_names[i] << "\", \"count\": "
+            << opcode_counts[i] << ", \"cycles\": " << opcode_cycles[i] << "}";
+        first = false;
+    }
+    out << "\n  ],\n  \"addresses\": [";
+    first = true;
+    for (int i = 0; i < mem_size; i++) {
+        if (address_counts[i] == 0)
+            continue;
+        out << (first ? "\n" : ",\n") << "    {\"address\": " << i << ", \"count\": " << address_counts[i] << "}";
+        first = false;
+    }
+    out << "\n  ],\n"
+        << "  \"skipped_instructions\": " << skipped_instructions << ",\n"
+        << "  \"sprites\": {\"drawn\": " << sprites_drawn << ", \"rows\": " << sprite_rows_drawn
+        << ", \"collided_rows\": " << collided_rows << ", \"collided\": " << collided_sprites << "}\n"
+        << "}\n";
+}
+
+void Profiler::write_csv(std::ostream& out) {
+    out << "section,name,count,cycles\n";
+    for (int i = 0; i < OPCODE_COUNT; i++) {
+        if (opcode_counts[i] != 0)
+            out << "opcode," << opcode_names[i] << "," << opcode_counts[i] << "," << opcode_cycles[i] << "\n";
+    }
+    for (int i = 0; i < mem_size; i++) {
+        if (address_counts[i] != 0) {
+            out << "address,0x" << std::hex << std::setw(3) << std::setfill('0') << i << std::dec
+                << "," << address_counts[i] << ",\n";
+        }
+    }
+    out << "idle,skipped_instructions," << skipped_instructions << ",\n"
+        << "sprites,drawn," << sprites_drawn << ",\n"
+        << "sprites,rows," << sprite_rows_drawn << ",\n"
+        << "sprites,collided_rows," << collided_rows << ",\n"
+        << "sprites,collided," << collided_sprites << ",\n";
+}
@@ -0,0 +1,36 @@
+// Execution statistics, collected when built with CHIMP8_PROFILER
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include "Chip8.h"
+
+// Attach to a VM with Chip8::set_profiler to start counting
+struct Profiler {
+    // Executions and COSMAC cycles (including data-dependent ones) per opcode
+    uint64_t opcode_counts[OPCODE_COUNT] = {};
+    uint64_t opcode_cycles[OPCODE_COUNT] = {};
+    // Opcodes executed at each address
+    uint64_t address_counts[mem_size] = {};
+    // Idle loop opcodes that were skipped rather than executed. They're
+    // included in the counts above, as if they had run
+    uint64_t skipped_instructions = 0;
+    // DXYN: sprites drawn, their rows, rows that hit set pixels, and sprites with any such row
+    uint64_t sprites_drawn = 0;
+    uint64_t sprite_rows_drawn = 0;
+    uint64_t collided_rows = 0;
+    uint64_t collided_sprites = 0;
+
+    // Write as JSON, or as CSV if file_name ends in .csv
+    bool write(const std::string& file_name);
+    void write_json(std::ostream& out);
+    // One "section,name,count,cycles" row per statistic
+    void write_csv(std::ostream& out);
+};
+
+// Display names, indexed by OpcodeId
+extern const char* const opcode_names[OPCODE_COUNT];
+
+#endif
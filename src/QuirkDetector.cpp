@@ -0,0 +1,102 @@
+#include "QuirkDetector.h"
+#include <map>
+#include <stdexcept>
+
+constexpr uint64_t frames_per_second = 60;
+// Every quirk_key_period frames, a key is held for quirk_key_frames, cycling
+// through the keypad so that ROMs get past their title screens
+constexpr uint64_t quirk_key_period = 30;
+constexpr uint64_t quirk_key_frames = 6;
+constexpr uint8_t all_quirk_flags = ROM_LEGACY_SHIFT | ROM_LEGACY_MEMOPS;
+
+static uint64_t hash_display(Chip8* vm, uint64_t hash) {
+    for (int row = 0; row < screen_h; row++) {
+        const uint64_t* words = vm->get_display_row(row);
+        for (int i = 0; i < display_row_words; i++) {
+            hash ^= words[i];
+            hash *= 0x100000001b3;
+        }
+    }
+    return hash;
+}
+
+static void run_quirks(const uint8_t* rom, size_t rom_size, uint64_t cycle_rate, QuirkRun& run) {
+    Chip8 vm;
+    vm.set_timing_mode(run.timing_mode);
+    vm.set_cycle_rate(cycle_rate);
+    vm.set_legacy_shift(run.flags & ROM_LEGACY_SHIFT);
+    vm.set_legacy_memops(run.flags & ROM_LEGACY_MEMOPS);
+    vm.load_rom(rom, rom_size);
+    run.faulted = false;
+    run.display_signature = 0xcbf29ce484222325;
+    uint64_t cycles_run = 0;
+    for (run.frames = 0; run.frames < detect_seconds * frames_per_second; run.frames++) {
+        uint64_t phase = run.frames % quirk_key_period;
+        int key = run.frames / quirk_key_period % key_count;
+        if (phase == 0)
+            vm.on_keypress(key);
+        else if (phase == quirk_key_frames)
+            vm.on_keyrelease(key);
+        uint64_t frame_end = (run.frames + 1) * vm.get_cycle_rate() / frames_per_second;
+        try {
+            vm.run_for(frame_end - cycles_run);
+        }
+        catch (std::runtime_error&) {
+            run.faulted = true;
+            return;
+        }
+        cycles_run = frame_end;
+        // Running the font or the interpreter's area means the program went astray
+        uint16_t pc = vm.get_state().pc;
+        if (pc < 0x200 || pc >= mem_size) {
+            run.faulted = true;
+            return;
+        }
+        if ((run.frames + 1) % frames_per_second == 0)
+            run.display_signature = hash_display(&vm, run.display_signature);
+        if (vm.was_exit_opcode_called())
+            return;
+    }
+}
+
+RomProfile detect_rom_profile(const uint8_t* rom, size_t rom_size, uint64_t cycle_rate, ThreadPool* pool,
+    std::vector<QuirkRun>* runs) {
+    std::vector<QuirkRun> all_runs;
+    for (TimingMode timing_mode : { TIMING_FIXED, TIMING_COSMAC }) {
+        for (uint8_t flags = 0; flags <= all_quirk_flags; flags++)
+            all_runs.push_back({ timing_mode, flags, false, 0, 0 });
+    }
+    pool->parallel_for(all_runs.size(), [&](size_t i) {
+        run_quirks(rom, rom_size, cycle_rate, all_runs[i]);
+    });
+
+    RomProfile profile = {};
+    profile.hash = hash_rom(rom, rom_size);
+    for (TimingMode timing_mode : { TIMING_FIXED, TIMING_COSMAC }) {
+        // Runs that didn't fault, grouped by what they displayed
+        std::map<uint64_t, std::vector<const QuirkRun*>> agreeing;
+        for (const QuirkRun& run : all_runs) {
+            if (run.timing_mode == timing_mode && !run.faulted)
+                agreeing[run.display_signature].push_back(&run);
+        }
+        const QuirkRun* best = NULL;
+        size_t best_agreement = 0;
+        for (const auto& group : agreeing) {
+            // Runs are in order of flags, so the first is the closest to the defaults
+            const QuirkRun* run = group.second.front();
+            if (group.second.size() > best_agreement
+                || (group.second.size() == best_agreement && run->flags < best->flags)) {
+                best = run;
+                best_agreement = group.second.size();
+            }
+        }
+        if (best) {
+            profile.timing_mode = timing_mode;
+            profile.flags = best->flags;
+            break;
+        }
+    }
+    if (runs)
+        *runs = all_runs;
+    return profile;
+}
@@ -0,0 +1,38 @@
+// Guessing a ROM's quirk settings by running it under all of them
+#ifndef QUIRKDETECTOR_H
+#define QUIRKDETECTOR_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "Chip8.h"
+#include "RomDatabase.h"
+#include "ThreadPool.h"
+
+// Emulated time each combination runs for
+constexpr uint64_t detect_seconds = 5;
+
+// Outcome of running a ROM with one combination of settings
+struct QuirkRun {
+    TimingMode timing_mode;
+    // RomProfileFlags
+    uint8_t flags;
+    // Threw, or jumped outside the program
+    bool faulted;
+    // Frames run before the fault or 00FD, or detect_seconds of them
+    uint64_t frames;
+    // Hash of the display once per second, equal if the runs looked the same
+    uint64_t display_signature;
+};
+
+// Run the ROM under every timing mode and quirk combination, sharing them
+// among the pool's threads, with the same scripted key presses. Runs that
+// fault are ruled out. For each timing mode, the quirk flags chosen are
+// the ones most runs agree with on the display, since quirks the ROM
+// doesn't depend on give the same result; ties go to fewer legacy quirks.
+// Fixed timing is preferred unless all of its runs fault. runs, if given,
+// receives every run
+RomProfile detect_rom_profile(const uint8_t* rom, size_t rom_size, uint64_t cycle_rate, ThreadPool* pool,
+    std::vector<QuirkRun>* runs = NULL);
+
+#endif
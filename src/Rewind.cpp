@@ -0,0 +1,145 @@
+#include "Rewind.h"
+#include <cstring>
+
+// Delta records: a 16-bit count of unchanged words to skip, a 16-bit count
+// of changed words, then the XOR of each of those words. Changes tend to be
+// a few bytes within a word, so each XOR is stored as a mask of its nonzero
+// bytes followed by just those bytes. Trailing unchanged words aren't stored.
+constexpr size_t record_header_size = 2 * sizeof(uint16_t);
+
+Rewind::Rewind(size_t max_frames, size_t buffer_size)
+    : entries(max_frames), buffer(buffer_size), latest(snapshot_words), current(snapshot_words) {
+    // Worst case, every word changed in a single record. Records after the
+    // first skip at least two words, which costs more than their header saves
+    scratch.resize(record_header_size + snapshot_words * (1 + sizeof(uint64_t)));
+}
+
+void Rewind::capture(Chip8* vm) {
+    vm->save_snapshot(*(Chip8Snapshot*)current.data());
+    if (!has_latest) {
+        latest.swap(current);
+        has_latest = true;
+        return;
+    }
+    size_t delta_size = encode_delta();
+    latest.swap(current);
+    if (entries.empty() || delta_size > buffer.size()) {
+        // Can't keep any history
+        clear();
+        has_latest = true;
+        return;
+    }
+
+    if (entry_count == entries.size())
+        drop_oldest();
+    // Entries are contiguous, start over at the beginning if it doesn't fit at the end
+    size_t offset = 0;
+    if (entry_count > 0) {
+        const Entry& newest = entries[(first_entry + entry_count - 1) % entries.size()];
+        offset = newest.offset + newest.size;
+        if (offset + delta_size > buffer.size()) {
+            // Entries past the newest are the oldest ones, from before the last wrap
+            while (entry_count > 0 && entries[first_entry].offset >= offset)
+                drop_oldest();
+            offset = 0;
+        }
+    }
+    // Drop entries the new one would overwrite
+    while (entry_count > 0) {
+        const Entry& oldest = entries[first_entry];
+        if (oldest.offset >= offset + delta_size || oldest.offset + oldest.size <= offset)
+            break;
+        drop_oldest();
+    }
+    std::memcpy(buffer.data() + offset, scratch.data(), delta_size);
+    entries[(first_entry + entry_count) % entries.size()] = { offset, delta_size };
+    entry_count++;
+}
+
+bool Rewind::step_back(Chip8* vm) {
+    if (entry_count == 0)
+        return false;
+    const Entry& newest = entries[(first_entry + entry_count - 1) % entries.size()];
+    apply_delta(buffer.data() + newest.offset, newest.size);
+    entry_count--;
+    return vm->load_snapshot(*(const Chip8Snapshot*)latest.data());
+}
+
+void Rewind::clear() {
+    first_entry = 0;
+    entry_count = 0;
+    has_latest = false;
+}
+
+size_t Rewind::get_frame_count() {
+    return entry_count;
+}
+
+size_t Rewind::get_used_bytes() {
+    size_t used = 0;
+    for (size_t i = 0; i < entry_count; i++)
+        used += entries[(first_entry + i) % entries.size()].size;
+    return used;
+}
+
+size_t Rewind::encode_delta() {
+    uint8_t* out = scratch.data();
+    size_t word = 0;
+    while (true) {
+        size_t run_start = word;
+        while (word < snapshot_words && current[word] == latest[word])
+            word++;
+        if (word == snapshot_words)
+            break;
+        uint16_t skip = word - run_start;
+        size_t literal_start = word;
+        // A single unchanged word costs less to store than a new record header
+        while (word < snapshot_words && (current[word] != latest[word]
+            || (word + 1 < snapshot_words && current[word + 1] != latest[word + 1])))
+            word++;
+        uint16_t literal = word - literal_start;
+
+        std::memcpy(out, &skip, sizeof(skip));
+        std::memcpy(out + sizeof(skip), &literal, sizeof(literal));
+        out += record_header_size;
+        for (size_t i = literal_start; i < word; i++) {
+            uint64_t delta = current[i] ^ latest[i];
+            uint8_t* mask = out++;
+            *mask = 0;
+            for (int byte = 0; byte < 8; byte++) {
+                uint8_t bits = delta >> (byte * 8);
+                if (bits) {
+                    *mask |= 1 << byte;
+                    *out++ = bits;
+                }
+            }
+        }
+    }
+    return out - scratch.data();
+}
+
+void Rewind::apply_delta(const uint8_t* delta, size_t size) {
+    const uint8_t* end = delta + size;
+    size_t word = 0;
+    while (delta < end) {
+        uint16_t skip, literal;
+        std::memcpy(&skip, delta, sizeof(skip));
+        std::memcpy(&literal, delta + sizeof(skip), sizeof(literal));
+        delta += record_header_size;
+        word += skip;
+        for (uint16_t i = 0; i < literal; i++) {
+            uint8_t mask = *delta++;
+            uint64_t bits = 0;
+            for (int byte = 0; byte < 8; byte++) {
+                if (mask & (1 << byte))
+                    bits |= (uint64_t)*delta++ << (byte * 8);
+            }
+            latest[word++] ^= bits;
+        }
+    }
+}
+
+void Rewind::drop_oldest() {
+    first_entry = (first_entry + 1) % entries.size();
+    entry_count--;
+}
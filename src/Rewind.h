@@ -0,0 +1,54 @@
+// History of recent VM states for stepping backwards
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "Chip8.h"
+
+// Keeps the latest captured state in full, and each older one as an XOR
+// delta against the state after it, run-length encoded over 64-bit words.
+// Deltas live in a fixed-size byte ring; the oldest are dropped to make room.
+class Rewind {
+public:
+    // Hold up to max_frames steps back, in at most buffer_size bytes of deltas
+    Rewind(size_t max_frames, size_t buffer_size);
+    void capture(Chip8* vm);
+    // Restore the state captured before the latest one, and forget the latest.
+    // Returns false if there's nothing left to go back to
+    bool step_back(Chip8* vm);
+    void clear();
+    // Number of states step_back can still restore
+    size_t get_frame_count();
+    // Bytes of deltas in use, not counting the full latest state
+    size_t get_used_bytes();
+private:
+    static constexpr size_t snapshot_words = sizeof(Chip8Snapshot) / sizeof(uint64_t);
+    static_assert(sizeof(Chip8Snapshot) % sizeof(uint64_t) == 0, "Snapshots are diffed in whole words");
+    static_assert(snapshot_words <= UINT16_MAX, "Run lengths are stored in 16 bits");
+
+    struct Entry {
+        size_t offset;
+        size_t size;
+    };
+
+    // Entries oldest first, as a circular queue
+    std::vector<Entry> entries;
+    size_t first_entry = 0;
+    size_t entry_count = 0;
+    std::vector<uint8_t> buffer;
+    std::vector<uint64_t> latest;
+    bool has_latest = false;
+    // Delta being captured, before it's copied into the ring
+    std::vector<uint8_t> scratch;
+    std::vector<uint64_t> current;
+
+    // Encode current XOR latest into scratch, returns the encoded size
+    size_t encode_delta();
+    // XOR an encoded delta into latest
+    void apply_delta(const uint8_t* delta, size_t size);
+    void drop_oldest();
+};
+
+#endif
@@ -0,0 +1,65 @@
+#include "RomDatabase.h"
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+
+uint64_t hash_rom(const uint8_t* rom, size_t rom_size) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < rom_size; i++) {
+        hash ^= rom[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+bool RomDatabase::open(const std::string& file_name) {
+    profile_count = 0;
+    RomDatabaseHeader header;
+    if (!file.open(file_name) || file.size() < sizeof(header))
+        return false;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (header.magic != rom_database_magic || header.version != rom_database_version
+        || header.profile_size != sizeof(RomProfile)
+        || header.profile_count > (file.size() - sizeof(header)) / sizeof(RomProfile)) {
+        file.close();
+        return false;
+    }
+    profile_count = header.profile_count;
+    return true;
+}
+
+bool RomDatabase::find(uint64_t hash, RomProfile& profile) {
+    const uint8_t* profiles = file.data() + sizeof(RomDatabaseHeader);
+    // First profile with a hash not less than the one wanted
+    uint32_t begin = 0;
+    uint32_t end = profile_count;
+    while (begin < end) {
+        uint32_t middle = begin + (end - begin) / 2;
+        uint64_t middle_hash;
+        std::memcpy(&middle_hash, profiles + (size_t)middle * sizeof(RomProfile), sizeof(middle_hash));
+        if (middle_hash < hash)
+            begin = middle + 1;
+        else
+            end = middle;
+    }
+    if (begin == profile_count)
+        return false;
+    std::memcpy(&profile, profiles + (size_t)begin * sizeof(RomProfile), sizeof(profile));
+    return profile.hash == hash;
+}
+
+bool write_rom_database(const std::string& file_name, std::vector<RomProfile> profiles) {
+    std::sort(profiles.begin(), profiles.end(),
+        [](const RomProfile& a, const RomProfile& b) { return a.hash < b.hash; });
+    RomDatabaseHeader header;
+    header.magic = rom_database_magic;
+    header.version = rom_database_version;
+    header.profile_size = sizeof(RomProfile);
+    header.profile_count = profiles.size();
+    std::ofstream database_file(file_name, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!database_file)
+        return false;
+    database_file.write((const char*)&header, sizeof(header));
+    database_file.write((const char*)profiles.data(), sizeof(RomProfile) * profiles.size());
+    return !database_file.fail();
+}
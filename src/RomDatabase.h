@@ -0,0 +1,62 @@
+// Per-ROM settings, looked up by a hash of the ROM's contents
+#ifndef ROMDATABASE_H
+#define ROMDATABASE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "Chip8.h"
+#include "Platform.h"
+
+constexpr uint32_t rom_database_magic = 0x42444D52; // "RMDB"
+// Bump when RomDatabaseHeader or RomProfile change
+constexpr uint32_t rom_database_version = 1;
+
+enum RomProfileFlags : uint8_t {
+    ROM_LEGACY_SHIFT = 1,
+    ROM_LEGACY_MEMOPS = 2,
+};
+
+// Start of a database file, followed by the profiles sorted by hash
+struct RomDatabaseHeader {
+    uint32_t magic;
+    uint32_t version;
+    // sizeof(RomProfile)
+    uint32_t profile_size;
+    uint32_t profile_count;
+};
+
+struct RomProfile {
+    // hash_rom of the ROM file
+    uint64_t hash;
+    // Cycles per second in fixed timing, 0 to keep the configured rate
+    uint32_t cycle_rate;
+    // TimingMode
+    uint8_t timing_mode;
+    // RomProfileFlags
+    uint8_t flags;
+    uint16_t reserved;
+};
+static_assert(sizeof(RomProfile) == 16, "Profiles are stored as is");
+
+// 64-bit FNV-1a
+uint64_t hash_rom(const uint8_t* rom, size_t rom_size);
+
+// Read-only database, mapped rather than parsed so that opening it costs
+// the same however many ROMs it has
+class RomDatabase {
+public:
+    // Returns false if the file is missing or isn't a compatible database
+    bool open(const std::string& file_name);
+    // Binary search for the ROM's profile
+    bool find(uint64_t hash, RomProfile& profile);
+private:
+    MappedFile file;
+    uint32_t profile_count = 0;
+};
+
+// Sort the profiles and write them out as a database
+bool write_rom_database(const std::string& file_name, std::vector<RomProfile> profiles);
+
+#endif
@@ -0,0 +1,22 @@
+#include "Snapshot.h"
+#include "Platform.h"
+#include <fstream>
+#include <memory>
+
+bool save_snapshot_file(const std::string& file_name, Chip8* vm) {
+    std::unique_ptr<Chip8Snapshot> snapshot(new Chip8Snapshot);
+    vm->save_snapshot(*snapshot);
+    std::ofstream snapshot_file(file_name, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!snapshot_file)
+        return false;
+    snapshot_file.write((const char*)snapshot.get(), sizeof(Chip8Snapshot));
+    return !snapshot_file.fail();
+}
+
+bool load_snapshot_file(const std::string& file_name, Chip8* vm) {
+    // Restore straight from the mapped file, without reading it into a buffer first
+    MappedFile snapshot_file;
+    if (!snapshot_file.open(file_name) || snapshot_file.size() != sizeof(Chip8Snapshot))
+        return false;
+    return vm->load_snapshot(*(const Chip8Snapshot*)snapshot_file.data());
+}
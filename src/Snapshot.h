@@ -0,0 +1,13 @@
+// Save states on disk
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <string>
+#include "Chip8.h"
+
+// The file is a Chip8Snapshot as laid out in memory, so it's only portable
+// between builds with the same layout; loading checks for that
+bool save_snapshot_file(const std::string& file_name, Chip8* vm);
+bool load_snapshot_file(const std::string& file_name, Chip8* vm);
+
+#endif
@@ -0,0 +1,43 @@
+// Lock-free queue between exactly one producer thread and one consumer thread
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+template<typename T, size_t capacity>
+class SpscQueue {
+    static_assert(capacity > 0 && (capacity & (capacity - 1)) == 0, "Capacity must be a power of two");
+public:
+    // Producer only. Returns false if the queue is full
+    bool push(const T& item) {
+        size_t tail = tail_index.load(std::memory_order_relaxed);
+        if (tail - head_index.load(std::memory_order_acquire) == capacity)
+            return false;
+        items[tail & (capacity - 1)] = item;
+        tail_index.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. Oldest item, or NULL if the queue is empty. Stays valid until pop
+    const T* front() {
+        size_t head = head_index.load(std::memory_order_relaxed);
+        if (head == tail_index.load(std::memory_order_acquire))
+            return NULL;
+        return &items[head & (capacity - 1)];
+    }
+
+    // Consumer only. Remove the item returned by front
+    void pop() {
+        head_index.store(head_index.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+private:
+    T items[capacity];
+    // Indices only ever increase; each is written by one side. Kept on
+    // separate cache lines so the two threads don't contend for one
+    alignas(64) std::atomic<size_t> head_index{0};
+    alignas(64) std::atomic<size_t> tail_index{0};
+};
+
+#endif
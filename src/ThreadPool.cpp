@@ -0,0 +1,67 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned thread_count) {
+    if (thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned i = 1; i < thread_count; i++)
+        workers.emplace_back(&ThreadPool::worker_loop, this);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for (std::thread& worker : workers)
+        worker.join();
+}
+
+unsigned ThreadPool::get_thread_count() {
+    return workers.size() + 1;
+}
+
+void ThreadPool::parallel_for(size_t count, const std::function<void(size_t)>& new_task) {
+    if (workers.empty() || count <= 1) {
+        for (size_t i = 0; i < count; i++)
+            new_task(i);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        task = &new_task;
+        item_count = count;
+        next_item.store(0, std::memory_order_relaxed);
+        busy_workers = workers.size();
+        generation++;
+    }
+    work_ready.notify_all();
+    // The calling thread works too
+    run_items();
+    std::unique_lock<std::mutex> lock(mutex);
+    work_done.wait(lock, [this] { return busy_workers == 0; });
+    task = NULL;
+}
+
+void ThreadPool::worker_loop() {
+    uint64_t seen_generation = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        work_ready.wait(lock, [&] { return stopping || generation != seen_generation; });
+        if (stopping)
+            return;
+        seen_generation = generation;
+        lock.unlock();
+        run_items();
+        lock.lock();
+        if (--busy_workers == 0)
+            work_done.notify_one();
+    }
+}
+
+void ThreadPool::run_items() {
+    size_t item;
+    while ((item = next_item.fetch_add(1, std::memory_order_relaxed)) < item_count)
+        (*task)(item);
+}
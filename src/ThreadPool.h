@@ -0,0 +1,44 @@
+// Worker threads for running loops in parallel
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <cstddef>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Items of a parallel loop are claimed one at a time from a shared counter,
+// so threads that finish their items early keep taking the remaining ones
+class ThreadPool {
+public:
+    // thread_count includes the calling thread, 0 for one per hardware thread
+    explicit ThreadPool(unsigned thread_count = 0);
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ~ThreadPool();
+    unsigned get_thread_count();
+    // Call task(i) for every i below count, returning once all calls are done
+    void parallel_for(size_t count, const std::function<void(size_t)>& task);
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work_ready;
+    std::condition_variable work_done;
+    // Loop in progress
+    const std::function<void(size_t)>* task = NULL;
+    size_t item_count = 0;
+    std::atomic<size_t> next_item{0};
+    // Workers still running items of the loop
+    size_t busy_workers = 0;
+    // Incremented for each loop, so workers can tell a new one started
+    uint64_t generation = 0;
+    bool stopping = false;
+
+    void worker_loop();
+    void run_items();
+};
+
+#endif
@@ -0,0 +1,92 @@
+#include "Trace.h"
+
+Tracer::~Tracer() {
+    close();
+}
+
+bool Tracer::open(const std::string& file_name, Chip8* vm) {
+    close();
+    file = std::fopen(file_name.c_str(), "wb");
+    if (!file)
+        return false;
+    TraceHeader header = { trace_magic, trace_version, sizeof(TraceRecord),
+        (uint32_t)vm->get_timing_mode(), vm->get_cycle_rate() };
+    if (std::fwrite(&header, sizeof(header), 1, file) != 1) {
+        std::fclose(file);
+        file = NULL;
+        return false;
+    }
+
+    blocks.resize(trace_block_count * trace_block_records);
+    next = blocks.data();
+    block_end = next + trace_block_records;
+    filled_blocks = 0;
+    written_blocks = 0;
+    last_block_records = 0;
+    stopping = false;
+    write_failed = false;
+    writer = std::thread(&Tracer::write_blocks, this);
+    return true;
+}
+
+bool Tracer::close() {
+    if (!file)
+        return true;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // The partly filled block goes out last
+        last_block_records = next - &blocks[(filled_blocks % trace_block_count) * trace_block_records];
+        filled_blocks++;
+        stopping = true;
+    }
+    changed.notify_all();
+    writer.join();
+
+    bool written = !write_failed;
+    if (std::fclose(file) != 0)
+        written = false;
+    file = NULL;
+    next = NULL;
+    block_end = NULL;
+    return written;
+}
+
+uint64_t Tracer::get_record_count() {
+    if (filled_blocks == 0)
+        return file ? next - blocks.data() : 0;
+    if (!file)
+        return (filled_blocks - 1) * trace_block_records + last_block_records;
+    return filled_blocks * trace_block_records
+        + (next - &blocks[(filled_blocks % trace_block_count) * trace_block_records]);
+}
+
+void Tracer::next_block() {
+    std::unique_lock<std::mutex> lock(mutex);
+    filled_blocks++;
+    changed.notify_all();
+    // Rather than losing records, execution waits for the writer to catch up
+    changed.wait(lock, [this] { return filled_blocks - written_blocks < trace_block_count; });
+    next = &blocks[(filled_blocks % trace_block_count) * trace_block_records];
+    block_end = next + trace_block_records;
+}
+
+void Tracer::write_blocks() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        changed.wait(lock, [this] { return written_blocks < filled_blocks || stopping; });
+        if (written_blocks == filled_blocks)
+            break;
+        uint64_t block = written_blocks;
+        size_t count = stopping && block + 1 == filled_blocks ? last_block_records : trace_block_records;
+        lock.unlock();
+
+        const TraceRecord* records = &blocks[(block % trace_block_count) * trace_block_records];
+        bool written = std::fwrite(records, sizeof(TraceRecord), count, file) == count;
+
+        lock.lock();
+        if (!written)
+            write_failed = true;
+        written_blocks++;
+        changed.notify_all();
+    }
+}
@@ -0,0 +1,85 @@
+// Binary execution trace, one record per executed opcode
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "Chip8.h"
+
+constexpr uint32_t trace_magic = 0x45435254; // "TRCE"
+constexpr uint32_t trace_version = 1;
+// TraceRecord::reg when the opcode didn't change any register
+constexpr uint8_t trace_no_register = 0xFF;
+// Records are handed to the writer a block at a time
+constexpr size_t trace_block_records = 4096;
+constexpr size_t trace_block_count = 64;
+
+// Start of a trace file, followed by the records until the end of the file
+struct TraceHeader {
+    uint32_t magic;
+    uint32_t version;
+    // sizeof(TraceRecord)
+    uint32_t record_size;
+    uint32_t timing_mode;
+    uint64_t cycle_rate;
+};
+
+struct TraceRecord {
+    // Cycle the opcode started on
+    uint64_t cycle;
+    uint16_t pc;
+    uint16_t opcode;
+    // I after the opcode
+    uint16_t address_reg;
+    // Lowest register the opcode changed, or trace_no_register, and its new value
+    uint8_t reg;
+    uint8_t value;
+};
+static_assert(sizeof(TraceRecord) == 16, "Trace records are written as is");
+
+// Attach to a VM with Chip8::set_tracer. The VM fills a ring of blocks,
+// and a background thread writes each one out as it fills up
+class Tracer {
+public:
+    Tracer() = default;
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+    ~Tracer();
+    bool open(const std::string& file_name, Chip8* vm);
+    // Write out the records so far and stop the writer. Returns false if any write failed
+    bool close();
+    // Slot for the next record, valid until the next call
+    TraceRecord* next_record() {
+        if (next == block_end)
+            next_block();
+        return next++;
+    }
+    uint64_t get_record_count();
+private:
+    std::FILE* file = NULL;
+    std::vector<TraceRecord> blocks;
+    TraceRecord* next = NULL;
+    TraceRecord* block_end = NULL;
+    // Blocks handed to the writer and blocks written, ever. Block N is at
+    // N % trace_block_count in the ring
+    uint64_t filled_blocks = 0;
+    uint64_t written_blocks = 0;
+    // Records in the block being filled when the trace was closed
+    size_t last_block_records = 0;
+    bool stopping = false;
+    bool write_failed = false;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::thread writer;
+
+    // Hand the current block to the writer and wait for a free one
+    void next_block();
+    void write_blocks();
+};
+
+#endif
@@ -0,0 +1,49 @@
+// Lock-free hand-off of the latest value from one writer thread to one reader thread
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+// The writer fills the back slot and publishes it, the reader picks up the
+// most recently published one. Neither ever waits for the other; values
+// published faster than they're read are skipped.
+template<typename T>
+class TripleBuffer {
+public:
+    // Writer only. Slot to fill in completely before publishing, it holds stale data
+    T& back() {
+        return slots[back_index];
+    }
+
+    // Writer only. Make the back slot the latest value
+    void publish() {
+        back_index = middle.exchange(back_index | fresh_bit, std::memory_order_acq_rel) & index_mask;
+    }
+
+    // Reader only. Move to the latest value, if one was published since the
+    // last call. Returns whether front changed
+    bool update() {
+        if (!(middle.load(std::memory_order_relaxed) & fresh_bit))
+            return false;
+        front_index = middle.exchange(front_index, std::memory_order_acq_rel) & index_mask;
+        return true;
+    }
+
+    // Reader only. Stays valid until the next update
+    const T& front() {
+        return slots[front_index];
+    }
+
+private:
+    // Set on the middle index when it holds a value the reader hasn't taken
+    constexpr static int fresh_bit = 4;
+    constexpr static int index_mask = 3;
+
+    T slots[3] = {};
+    // Each side owns one slot, and they trade theirs for the one in the middle
+    int back_index = 0;
+    int front_index = 1;
+    alignas(64) std::atomic<int> middle{2};
+};
+
+#endif